@@ -0,0 +1,110 @@
+#include "threadpool.h"
+#include <algorithm>
+
+using namespace std;
+
+ThreadPool::ThreadPool(int threads) {
+    if (threads <= 0)
+        threads = max(1, (int)thread::hardware_concurrency());
+    generation = 0;
+    stopping = false;
+    for (int i = 0; i < threads; i++)
+        queues.push_back(unique_ptr<Queue>(new Queue()));
+    for (int i = 1; i < threads; i++)
+        workers.push_back(thread(&ThreadPool::work, this, i));
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        lock_guard<mutex> lock(wakeMutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (int i = 0; i < workers.size(); i++)
+        workers[i].join();
+}
+
+int ThreadPool::size() const {
+    return (int)queues.size();
+}
+
+void ThreadPool::parallelFor(int begin, int end, int grain, const function<void(int, int)>& f) {
+    int n = end - begin;
+    grain = max(grain, 1);
+    if (n <= 0)
+        return;
+    if (size() == 1 || n <= grain) {
+        f(begin, end);
+        return;
+    }
+
+    // a few chunks per thread leave room for stealing
+    int chunk = max(grain, (n + 4 * size() - 1) / (4 * size()));
+    int count = (n + chunk - 1) / chunk;
+    Job job;
+    job.body = &f;
+    job.remaining = count;
+    for (int c = 0; c < count; c++) {
+        Chunk range = { begin + c * chunk, min(end, begin + (c + 1) * chunk), &job };
+        Queue& queue = *queues[c % size()];
+        lock_guard<mutex> lock(queue.mutex);
+        queue.chunks.push_back(range);
+    }
+    {
+        lock_guard<mutex> lock(wakeMutex);
+        generation++;
+    }
+    wake.notify_all();
+
+    while (job.remaining > 0)
+        if (!runChunk(0))
+            this_thread::yield();
+}
+
+bool ThreadPool::runChunk(int self) {
+    Chunk range;
+    bool found = false;
+    {
+        Queue& own = *queues[self];
+        lock_guard<mutex> lock(own.mutex);
+        if (own.front < own.chunks.size()) {
+            range = own.chunks[own.front++];
+            found = true;
+        }
+        if (own.front == own.chunks.size()) {
+            own.chunks.clear();
+            own.front = 0;
+        }
+    }
+    for (int k = 1; !found && k < size(); k++) {
+        Queue& victim = *queues[(self + k) % size()];
+        lock_guard<mutex> lock(victim.mutex);
+        if (victim.front < victim.chunks.size()) {
+            range = victim.chunks.back();
+            victim.chunks.pop_back();
+            found = true;
+        }
+    }
+    if (!found)
+        return false;
+    (*range.job->body)(range.begin, range.end);
+    // the last access to the job, its caller may return right after
+    range.job->remaining--;
+    return true;
+}
+
+void ThreadPool::work(int self) {
+    unsigned seen = 0;
+    for (;;) {
+        {
+            unique_lock<mutex> lock(wakeMutex);
+            wake.wait(lock, [&] { return stopping || generation != seen; });
+            if (stopping)
+                return;
+            seen = generation;
+        }
+        // run chunks until the queues are drained, then sleep again
+        while (runChunk(self))
+            ;
+    }
+}
@@ -0,0 +1,71 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <memory>
+
+/**
+* Work-stealing thread pool for data parallel loops. parallelFor splits a
+* range into chunks that are dealt to per-thread queues; a thread takes
+* chunks from the front of its own queue and, once it runs dry, steals from
+* the back of the others. The calling thread works too, so a pool of n
+* threads starts n - 1 workers.
+*
+* Loops must not call parallelFor themselves, and only one thread at a time
+* may start loops on a pool.
+*/
+class ThreadPool {
+public:
+    /** threads <= 0 uses every hardware thread */
+    explicit ThreadPool(int threads = 0);
+    ~ThreadPool();
+    /** Threads taking part in a loop, the caller included */
+    int size() const;
+    /**
+    * Calls body(first, last) on chunks covering begin..end, concurrently, and
+    * returns when all are done. Chunks hold at least grain indices; ranges of
+    * at most grain run on the calling thread alone.
+    */
+    void parallelFor(int begin, int end, int grain, const std::function<void(int, int)>& body);
+
+private:
+    // one parallelFor call, living on the stack of its caller
+    struct Job {
+        const std::function<void(int, int)>* body;
+        // chunks not yet finished, the caller returns at 0
+        std::atomic<int> remaining;
+    };
+    // a chunk knows its call, so a worker still draining the queues after the
+    // previous call finished counts it against the right one
+    struct Chunk {
+        int begin, end;
+        Job* job;
+    };
+    struct Queue {
+        std::mutex mutex;
+        // chunks[front..] are queued; the vector keeps its capacity, so
+        // queueing does not allocate once the pool has seen a loop this size
+        std::vector<Chunk> chunks;
+        size_t front = 0;
+    };
+
+    std::vector<std::thread> workers;
+    // queue 0 belongs to the calling thread
+    std::vector<std::unique_ptr<Queue> > queues;
+    // bumped by every call once its chunks are queued, wakes the workers
+    unsigned generation;
+    std::mutex wakeMutex;
+    std::condition_variable wake;
+    bool stopping;
+
+    void work(int self);
+    /** Runs one chunk of the own queue or a stolen one, false if there was none */
+    bool runChunk(int self);
+};
+
+#endif
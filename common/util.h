@@ -3,6 +3,9 @@
 
 #include <vector>
 #include <string>
+#include <cstdlib>
+#include <cstdint>
+#include <new>
 
 /* We can use a function like this to print some GL capabilities of our adapter
 to the log file. handy if we want to debug problems on other people's computers
@@ -31,6 +34,40 @@ std::vector<T> slice(const std::vector<T>& v, int start = 0, int end = -1) {
     return nv;
 }
 
+/**
+* Allocator returning memory aligned to Alignment bytes (a cache line by
+* default). Use it for large per-element arrays that are streamed in loops.
+*/
+template<typename T, std::size_t Alignment = 64>
+struct AlignedAllocator {
+    typedef T value_type;
+    template<typename U> struct rebind { typedef AlignedAllocator<U, Alignment> other; };
+
+    AlignedAllocator() {}
+    template<typename U>
+    AlignedAllocator(const AlignedAllocator<U, Alignment>&) {}
+
+    T* allocate(std::size_t n) {
+        // over-allocate and keep the allocated pointer right before the aligned
+        // block; through operator new so that a replaced one sees these too
+        void* raw = ::operator new(n * sizeof(T) + Alignment + sizeof(void*));
+        std::uintptr_t start = reinterpret_cast<std::uintptr_t>(raw) + sizeof(void*);
+        std::uintptr_t aligned = (start + Alignment - 1) & ~std::uintptr_t(Alignment - 1);
+        reinterpret_cast<void**>(aligned)[-1] = raw;
+        return reinterpret_cast<T*>(aligned);
+    }
+
+    void deallocate(T* p, std::size_t) {
+        if (p != NULL)
+            ::operator delete(reinterpret_cast<void**>(p)[-1]);
+    }
+};
+
+template<typename T, typename U, std::size_t A>
+bool operator==(const AlignedAllocator<T, A>&, const AlignedAllocator<U, A>&) { return true; }
+template<typename T, typename U, std::size_t A>
+bool operator!=(const AlignedAllocator<T, A>&, const AlignedAllocator<U, A>&) { return false; }
+
 /**
 * Get base directory from file path.
 */
@@ -0,0 +1,57 @@
+#ifndef CACHE_FILE_H
+#define CACHE_FILE_H
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+/**
+* Helpers of the binary cache files that keep expensive precomputations
+* (vibration modes, embedding weights) across runs. A file is named after
+* an FNV-1a hash of everything the result depends on and starts with an
+* 8 byte magic and the hash; arrays are stored as their length followed by
+* their raw contents, in the byte order of the machine that wrote them.
+*/
+// FNV-1a offset basis, the start of every key
+const unsigned long long hashSeed = 14695981039346656037ull;
+
+/** FNV-1a over raw bytes */
+inline void hashBytes(unsigned long long& h, const void* data, size_t bytes) {
+    const unsigned char* p = (const unsigned char*)data;
+    for (size_t i = 0; i < bytes; i++) {
+        h ^= p[i];
+        h *= 1099511628211ull;
+    }
+}
+
+template<typename T, typename A>
+void hashArray(unsigned long long& h, const std::vector<T, A>& a) {
+    size_t n = a.size();
+    hashBytes(h, &n, sizeof(n));
+    hashBytes(h, a.data(), n * sizeof(T));
+}
+
+/** prefix-<key>.cache in directory, the working directory if it is empty */
+inline std::string cachePath(const std::string& directory, const char* prefix, unsigned long long key) {
+    char name[64];
+    snprintf(name, sizeof(name), "%s-%016llx.cache", prefix, key);
+    return directory.empty() ? std::string(name) : directory + "/" + name;
+}
+
+template<typename T, typename A>
+bool writeCacheArray(FILE* file, const std::vector<T, A>& a) {
+    unsigned long long n = a.size();
+    return fwrite(&n, sizeof(n), 1, file) == 1 && fwrite(a.data(), sizeof(T), a.size(), file) == a.size();
+}
+
+/** Reads an array written by writeCacheArray, at most limit elements */
+template<typename T, typename A>
+bool readCacheArray(FILE* file, std::vector<T, A>& a, unsigned long long limit) {
+    unsigned long long n = 0;
+    if (fread(&n, sizeof(n), 1, file) != 1 || n > limit)
+        return false;
+    a.resize((size_t)n);
+    return fread(a.data(), sizeof(T), a.size(), file) == a.size();
+}
+
+#endif
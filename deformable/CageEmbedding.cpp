@@ -0,0 +1,262 @@
+#include "CageEmbedding.h"
+#include "CacheFile.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+using namespace glm;
+using namespace std;
+
+// vertices per chunk of the parallel loop
+static const int vertexGrain = 1024;
+
+static const char proxyMagic[8] = { 'P', 'R', 'O', 'X', 'Y', '0', '0', '1' };
+
+CageEmbedding::CageEmbedding() {
+    threadPool = 0;
+    cached = false;
+}
+
+void CageEmbedding::build(const vector<vec3>& vertices, const vector<int>& triangles, int cells) {
+    int n = (int)vertices.size();
+    vec3 lower(0.0f), upper(0.0f);
+    if (n > 0)
+        lower = upper = vertices[0];
+    for (int v = 1; v < n; v++) {
+        lower = glm::min(lower, vertices[v]);
+        upper = glm::max(upper, vertices[v]);
+    }
+    vec3 extent = upper - lower;
+    float h = std::max(std::max(extent.x, extent.y), std::max(extent.z, 1e-6f)) / std::max(cells, 1);
+    ivec3 dims;
+    for (int a = 0; a < 3; a++)
+        dims[a] = std::max(1, int(std::ceil(extent[a] / h - 1e-4f)));
+    auto cellOf = [&](const vec3& p) {
+        ivec3 c(glm::floor((p - lower) / h));
+        return glm::clamp(c, ivec3(0), dims - 1);
+    };
+
+    // the cells the triangles touch, on a grid with a free layer around it
+    ivec3 padded = dims + 2;
+    auto paddedIndex = [&](int i, int j, int k) {
+        return i + padded.x * (j + padded.y * k);
+    };
+    vector<unsigned char> state(padded.x * padded.y * padded.z, 0);
+    const unsigned char touched = 1, outside = 2;
+    for (int v = 0; v < n; v++) {
+        ivec3 c = cellOf(vertices[v]) + 1;
+        state[paddedIndex(c.x, c.y, c.z)] = touched;
+    }
+    for (int t = 0; t + 2 < triangles.size(); t += 3) {
+        const vec3 &a = vertices[triangles[t]], &b = vertices[triangles[t + 1]], &c = vertices[triangles[t + 2]];
+        ivec3 first = cellOf(glm::min(a, glm::min(b, c))) + 1, last = cellOf(glm::max(a, glm::max(b, c))) + 1;
+        for (int k = first.z; k <= last.z; k++)
+            for (int j = first.y; j <= last.y; j++)
+                for (int i = first.x; i <= last.x; i++)
+                    state[paddedIndex(i, j, k)] = touched;
+    }
+
+    // flood the outside from a corner, what it cannot reach is enclosed
+    vector<ivec3> stack(1, ivec3(0));
+    state[0] = outside;
+    while (!stack.empty()) {
+        ivec3 c = stack.back();
+        stack.pop_back();
+        for (int a = 0; a < 3; a++)
+            for (int s = -1; s <= 1; s += 2) {
+                ivec3 d = c;
+                d[a] += s;
+                if (d[a] < 0 || d[a] >= padded[a])
+                    continue;
+                unsigned char& cell = state[paddedIndex(d.x, d.y, d.z)];
+                if (cell == 0) {
+                    cell = outside;
+                    stack.push_back(d);
+                }
+            }
+    }
+
+    // six tetrahedra around the main diagonal of every solid cell, nodes shared
+    ivec3 corners = dims + 1;
+    vector<int> nodeOf(corners.x * corners.y * corners.z, -1);
+    restNodes.clear();
+    auto node = [&](const ivec3& p) {
+        int& id = nodeOf[p.x + corners.x * (p.y + corners.y * p.z)];
+        if (id < 0) {
+            id = (int)restNodes.size();
+            restNodes.push_back(lower + h * vec3(p));
+        }
+        return id;
+    };
+    static const int permutations[6][3] = { { 0, 1, 2 }, { 0, 2, 1 }, { 1, 0, 2 }, { 1, 2, 0 }, { 2, 0, 1 }, { 2, 1, 0 } };
+    tets.clear();
+    // the tetrahedra of cell c are 6 * tetOfCell[c]..
+    vector<int> tetOfCell(dims.x * dims.y * dims.z, -1);
+    for (int k = 0; k < dims.z; k++)
+        for (int j = 0; j < dims.y; j++)
+            for (int i = 0; i < dims.x; i++) {
+                if (state[paddedIndex(i + 1, j + 1, k + 1)] == outside)
+                    continue;
+                tetOfCell[i + dims.x * (j + dims.y * k)] = (int)tets.size();
+                for (int p = 0; p < 6; p++) {
+                    ivec3 c(i, j, k);
+                    CorotationalFem::Tetrahedron tet;
+                    tet.v[0] = node(c);
+                    for (int e = 0; e < 3; e++) {
+                        c[permutations[p][e]]++;
+                        tet.v[e + 1] = node(c);
+                    }
+                    tets.push_back(tet);
+                }
+            }
+
+    buildFaces();
+
+    // barycentric coordinates: the tetrahedron holding a point walks the axes
+    // in decreasing order of its position in the cell
+    corner.resize(4 * n);
+    weight.resize(4 * n);
+    for (int v = 0; v < n; v++) {
+        ivec3 c = cellOf(vertices[v]);
+        vec3 f = glm::clamp((vertices[v] - lower) / h - vec3(c), 0.0f, 1.0f);
+        int p = 0;
+        while (!(f[permutations[p][0]] >= f[permutations[p][1]] && f[permutations[p][1]] >= f[permutations[p][2]]))
+            p++;
+        const CorotationalFem::Tetrahedron& tet = tets[tetOfCell[c.x + dims.x * (c.y + dims.y * c.z)] + p];
+        const int* axis = permutations[p];
+        float w[4] = { 1.0f - f[axis[0]], f[axis[0]] - f[axis[1]], f[axis[1]] - f[axis[2]], f[axis[2]] };
+        for (int a = 0; a < 4; a++) {
+            corner[4 * v + a] = tet.v[a];
+            weight[4 * v + a] = w[a];
+        }
+    }
+    setRenderIndices(vector<int>());
+}
+
+void CageEmbedding::build(const vector<vec3>& vertices, const vector<int>& triangles, int cells,
+    const string& cacheDirectory) {
+    unsigned long long h = hashSeed;
+    hashBytes(h, proxyMagic, sizeof(proxyMagic));
+    hashBytes(h, &cells, sizeof(cells));
+    hashArray(h, vertices);
+    hashArray(h, triangles);
+    string path = cachePath(cacheDirectory, "proxy", h);
+    cached = load(path, h, (int)vertices.size(), cells);
+    if (cached)
+        return;
+    build(vertices, triangles, cells);
+    save(path, h);
+}
+
+void CageEmbedding::buildFaces() {
+    faces.clear();
+    static const int faceCorners[4][3] = { { 0, 1, 2 }, { 0, 1, 3 }, { 0, 2, 3 }, { 1, 2, 3 } };
+    for (int e = 0; e < tets.size(); e++)
+        for (int f = 0; f < 4; f++)
+            for (int a = 0; a < 3; a++)
+                faces.push_back(tets[e].v[faceCorners[f][a]]);
+}
+
+bool CageEmbedding::load(const string& path, unsigned long long key, int n, int cells) {
+    FILE* file = fopen(path.c_str(), "rb");
+    if (file == NULL)
+        return false;
+    // the grid has at most cells^3 cells, so a damaged file cannot ask for much
+    unsigned long long c = std::max(cells, 1);
+    char magic[8];
+    unsigned long long storedKey = 0;
+    int storedVertices = 0;
+    bool ok = fread(magic, 1, 8, file) == 8 && memcmp(magic, proxyMagic, 8) == 0
+        && fread(&storedKey, sizeof(storedKey), 1, file) == 1 && storedKey == key
+        && fread(&storedVertices, sizeof(int), 1, file) == 1 && storedVertices == n
+        && readCacheArray(file, restNodes, (c + 1) * (c + 1) * (c + 1))
+        && readCacheArray(file, tets, 6 * c * c * c)
+        && readCacheArray(file, corner, 4ull * n)
+        && readCacheArray(file, weight, 4ull * n)
+        && corner.size() == 4ull * n && weight.size() == corner.size();
+    fclose(file);
+    for (int e = 0; ok && e < tets.size(); e++)
+        for (int a = 0; a < 4; a++)
+            ok = ok && tets[e].v[a] >= 0 && tets[e].v[a] < restNodes.size();
+    for (int i = 0; ok && i < corner.size(); i++)
+        ok = corner[i] >= 0 && corner[i] < restNodes.size();
+    if (!ok)
+        return false;
+    buildFaces();
+    setRenderIndices(vector<int>());
+    return true;
+}
+
+bool CageEmbedding::save(const string& path, unsigned long long key) const {
+    FILE* file = fopen(path.c_str(), "wb");
+    if (file == NULL)
+        return false;
+    int n = vertices();
+    bool ok = fwrite(proxyMagic, 1, 8, file) == 8
+        && fwrite(&key, sizeof(key), 1, file) == 1
+        && fwrite(&n, sizeof(int), 1, file) == 1
+        && writeCacheArray(file, restNodes)
+        && writeCacheArray(file, tets)
+        && writeCacheArray(file, corner)
+        && writeCacheArray(file, weight);
+    fclose(file);
+    return ok;
+}
+
+void CageEmbedding::setRenderIndices(const vector<int>& indices) {
+    int n = vertices();
+    slotStart.assign(n + 1, 0);
+    if (indices.empty()) {
+        slots.resize(n);
+        for (int v = 0; v < n; v++) {
+            slotStart[v + 1] = v + 1;
+            slots[v] = v;
+        }
+        return;
+    }
+    for (int s = 0; s < indices.size(); s++)
+        slotStart[indices[s] + 1]++;
+    for (int v = 0; v < n; v++)
+        slotStart[v + 1] += slotStart[v];
+    slots.resize(indices.size());
+    vector<int> next(slotStart.begin(), slotStart.end() - 1);
+    for (int s = 0; s < indices.size(); s++)
+        slots[next[indices[s]]++] = s;
+}
+
+const ParticleSystem::Vec3Array& CageEmbedding::nodes() const {
+    return restNodes;
+}
+
+const vector<CorotationalFem::Tetrahedron>& CageEmbedding::tetrahedra() const {
+    return tets;
+}
+
+const vector<int>& CageEmbedding::triangles() const {
+    return faces;
+}
+
+int CageEmbedding::vertices() const {
+    return (int)corner.size() / 4;
+}
+
+int CageEmbedding::outputs() const {
+    return (int)slots.size();
+}
+
+void CageEmbedding::deform(const ParticleSystem::Vec3Array& x, vector<vec3>& out) const {
+    out.resize(outputs());
+    auto body = [&](int first, int last) {
+        for (int v = first; v < last; v++) {
+            const int* c = &corner[4 * v];
+            const float* w = &weight[4 * v];
+            vec3 p = w[0] * x[c[0]] + w[1] * x[c[1]] + w[2] * x[c[2]] + w[3] * x[c[3]];
+            for (int s = slotStart[v]; s < slotStart[v + 1]; s++)
+                out[slots[s]] = p;
+        }
+    };
+    if (threadPool)
+        threadPool->parallelFor(0, vertices(), vertexGrain, cref(body));
+    else
+        body(0, vertices());
+}
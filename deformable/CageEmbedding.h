@@ -0,0 +1,77 @@
+#ifndef CAGE_EMBEDDING_H
+#define CAGE_EMBEDDING_H
+
+#include <vector>
+#include <string>
+#include <glm/glm.hpp>
+#include <common/threadpool.h>
+#include "ParticleSystem.h"
+#include "CorotationalFem.h"
+
+/**
+* A coarse tetrahedral proxy around a render mesh. Any solver simulates the
+* proxy, and the mesh is rebuilt from the proxy every frame. Physics then
+* costs the same whatever the resolution of the mesh.
+*
+* The proxy is made of the cells of a uniform grid that the triangles touch,
+* plus the cells these enclose. Each cell is split into the six tetrahedra
+* around its main diagonal, so neighbouring cells share their faces. Every
+* mesh vertex keeps the four barycentric coordinates of its tetrahedron,
+* which reproduce affine motions of the proxy exactly.
+*
+* Building can be cached in a file named after a hash of the mesh and the
+* cell count, for meshes too large to embed at every start.
+*/
+class CageEmbedding {
+public:
+    // pool for the reconstruction, none runs it on the calling thread
+    ThreadPool* threadPool;
+    // the proxy of the last build came from the cache
+    bool cached;
+
+    CageEmbedding();
+    /**
+    * Builds a proxy with the given number of cells along the longest side
+    * of the box of the vertices and embeds the vertices in it.
+    */
+    void build(const std::vector<glm::vec3>& vertices, const std::vector<int>& triangles, int cells);
+    /**
+    * Same, loading the proxy from cacheDirectory, where it is written after
+    * being built, if a previous run built it for the same mesh and cells.
+    */
+    void build(const std::vector<glm::vec3>& vertices, const std::vector<int>& triangles, int cells,
+        const std::string& cacheDirectory);
+    /**
+    * Makes the output out[s] = vertex indices[s] for every s, like a
+    * triangle list expanded for drawing; an empty list writes vertex v to
+    * out[v]. Set after build.
+    */
+    void setRenderIndices(const std::vector<int>& indices);
+    /** Rest positions of the proxy nodes */
+    const ParticleSystem::Vec3Array& nodes() const;
+    const std::vector<CorotationalFem::Tetrahedron>& tetrahedra() const;
+    /** The four faces of every tetrahedron as triangles, for the mesh springs */
+    const std::vector<int>& triangles() const;
+    /** Number of embedded vertices */
+    int vertices() const;
+    /** Size of the output */
+    int outputs() const;
+    /** Output for the proxy node positions x */
+    void deform(const ParticleSystem::Vec3Array& x, std::vector<glm::vec3>& out) const;
+
+private:
+    void buildFaces();
+    bool load(const std::string& path, unsigned long long key, int n, int cells);
+    bool save(const std::string& path, unsigned long long key) const;
+
+    ParticleSystem::Vec3Array restNodes;
+    std::vector<CorotationalFem::Tetrahedron> tets;
+    std::vector<int> faces;
+    // the corners and barycentric coordinates of vertex v are [4 * v..4 * v + 4)
+    std::vector<int> corner;
+    std::vector<float> weight;
+    // outputs of vertex v are slots[slotStart[v]..slotStart[v + 1])
+    std::vector<int> slotStart, slots;
+};
+
+#endif
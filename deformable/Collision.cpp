@@ -1,67 +1,100 @@
 #include "Collision.h"
 using namespace glm;
 
-void handleTopCollision(RigidBody& point, float top);
-bool checkTopStep(RigidBody& point, float top, float side);
+void handleTopCollision(ParticleSystem& points, int i, float top);
+bool checkTopStep(ParticleSystem& points, int i, float top, float side);
 
-bool checkSideStep(RigidBody& point, float top, float side);
-void handleSideCollision(RigidBody& point, float side);
+bool checkSideStep(ParticleSystem& points, int i, float top, float side);
+void handleSideCollision(ParticleSystem& points, int i, float side);
 
+// every step is the region x < side, y < top, listed from the highest one down
+const float stairSteps[4][2] = {
+	{ -1.0f, 0.25f },
+	{ -1.5f, 1.25f },
+	{ -2.0f, 2.25f },
+	{ -2.5f, 15.25f }
+};
 
-void checkStairCollision(RigidBody &point) {
 
-	if (checkSideStep(point, -1.0f, 0.25f))
+void checkStairCollision(ParticleSystem &points, int i) {
+
+	if (checkSideStep(points, i, -1.0f, 0.25f))
 	{
-		handleSideCollision(point, 0.25);
+		handleSideCollision(points, i, 0.25);
 	}
 
-	else if (checkTopStep(point, -1.0f, 0.25f)) {
-		handleTopCollision(point, -1.0f);
+	else if (checkTopStep(points, i, -1.0f, 0.25f)) {
+		handleTopCollision(points, i, -1.0f);
 	}
 
-	if (checkSideStep(point, -1.5f, 1.25f))
+	if (checkSideStep(points, i, -1.5f, 1.25f))
 	{
-		handleSideCollision(point, 1.25);
+		handleSideCollision(points, i, 1.25);
 	}
 
-	else if (checkTopStep(point, -1.5f, 1.25f)) {
-		handleTopCollision(point, -1.5f);
+	else if (checkTopStep(points, i, -1.5f, 1.25f)) {
+		handleTopCollision(points, i, -1.5f);
 	}
 
-	if (checkSideStep(point, -2.0f, 2.25f))
+	if (checkSideStep(points, i, -2.0f, 2.25f))
 	{
-		handleSideCollision(point, 2.25);
+		handleSideCollision(points, i, 2.25);
+	}
+
+	else if (checkTopStep(points, i, -2.0f, 2.25f)) {
+		handleTopCollision(points, i, -2.0f);
 	}
 
-	else if (checkTopStep(point, -2.0f, 2.25f)) {
-		handleTopCollision(point, -2.0f);
+	else if (checkTopStep(points, i, -2.5f, 15.25f)) {
+		handleTopCollision(points, i, -2.5f);
 	}
+}
+
+void checkStairCollision(ParticleSystem &points) {
+	// every particle is handled on its own, so the pool can split them freely
+	auto collide = [&points](int begin, int end) {
+		for (int i = begin; i < end; i++)
+			checkStairCollision(points, i);
+	};
+	points.parallel(collide);
+}
 
-	else if (checkTopStep(point, -2.5f, 15.25f)) {
-		handleTopCollision(point, -2.5f);
+bool projectStairContact(vec3 &x) {
+	bool inside = false;
+	for (int s = 0; s < 4; s++) {
+		float top = stairSteps[s][0];
+		float side = stairSteps[s][1];
+		if (x.y < top && x.x < side) {
+			if (side - x.x < top - x.y)
+				x.x = side;
+			else
+				x.y = top;
+			inside = true;
+		}
 	}
+	return inside;
 }
 
-bool checkTopStep(RigidBody& point, float top, float side) {
-	if (point.x.y < top && point.x.x < side)
+bool checkTopStep(ParticleSystem& points, int i, float top, float side) {
+	if (points.x[i].y < top && points.x[i].x < side)
 		return true;
 	return false;
 }
 
-void handleTopCollision(RigidBody& point, float top) {
-	point.x.y = top;
-	point.v = vec3(point.v.x, 0, point.v.z);
-	point.P = point.m * point.v;
+void handleTopCollision(ParticleSystem& points, int i, float top) {
+	points.x[i].y = top;
+	points.v[i] = vec3(points.v[i].x, 0, points.v[i].z);
+	points.P[i] = points.mass(i) * points.v[i];
 }
 
-bool checkSideStep(RigidBody& point, float top, float side) {
-	if (point.x.y < top - 0.02f && point.x.x < side && point.x.x > side - 0.02f)
+bool checkSideStep(ParticleSystem& points, int i, float top, float side) {
+	if (points.x[i].y < top - 0.02f && points.x[i].x < side && points.x[i].x > side - 0.02f)
 		return true;
 	return false;
 }
 
-void handleSideCollision(RigidBody& point, float side) {
-	point.x.x = side;
-	point.v = vec3(0, point.v.y, point.v.z);
-	point.P = point.m * point.v;
+void handleSideCollision(ParticleSystem& points, int i, float side) {
+	points.x[i].x = side;
+	points.v[i] = vec3(0, points.v[i].y, points.v[i].z);
+	points.P[i] = points.mass(i) * points.v[i];
 }
@@ -2,8 +2,13 @@
 #define COLLISION_H
 
 #include <glm/glm.hpp>
-#include "RigidBody.h"
+#include "ParticleSystem.h"
 
-void checkStairCollision(RigidBody &point);
+void checkStairCollision(ParticleSystem &points, int i);
+
+void checkStairCollision(ParticleSystem &points);
+
+/** Moves x out of the stairs through the closest step face, true if it was inside */
+bool projectStairContact(glm::vec3 &x);
 
 #endif
@@ -0,0 +1,204 @@
+#include "CorotationalFem.h"
+#include "ShapeMatching.h"
+#include "Point-Spring-Handling.h"
+#include <cmath>
+
+using namespace glm;
+using namespace std;
+
+CorotationalFem::CorotationalFem() {
+    youngModulus = 2000.0f;
+    poissonRatio = 0.3f;
+    dampingScale = 0.01f;
+    kFactor = 1.0f;
+    dampFactor = 1.0f;
+    patternSource = 0;
+}
+
+bool CorotationalFem::tetrahedralize(const ParticleSystem::Vec3Array& surface, const vector<int>& triangles,
+                                     ParticleSystem::Vec3Array& interior, vector<Tetrahedron>& tets) {
+    int n = (int)surface.size();
+    vec3 center(0.0f);
+    for (int i = 0; i < n; i++)
+        center += surface[i];
+    center /= float(n);
+    interior.assign(1, center);
+
+    tets.clear();
+    for (int t = 0; t + 2 < triangles.size(); t += 3) {
+        int a = triangles[t], b = triangles[t + 1], c = triangles[t + 2];
+        // outward triangles see the centre behind them
+        float volume = dot(cross(surface[b] - surface[a], surface[c] - surface[a]), center - surface[a]);
+        if (volume >= 0.0f)
+            return false;
+        Tetrahedron tet = { { n, a, b, c } };
+        tets.push_back(tet);
+    }
+    return !tets.empty();
+}
+
+void CorotationalFem::setElements(const ParticleSystem& points, const vector<Tetrahedron>& elements) {
+    int n = points.size();
+    tets = elements;
+    int m = (int)tets.size();
+    restCorners.resize(4 * m);
+    restInverse.resize(m);
+    stiffness.resize(16 * m);
+    rotation.assign(m, quat(1.0f, 0.0f, 0.0f, 0.0f));
+    cornerForces.resize(4 * m);
+    rotatedBlocks.resize(16 * m);
+
+    // Lame parameters for E = 1
+    float nu = poissonRatio;
+    float lambda = nu / ((1.0f + nu) * (1.0f - 2.0f * nu));
+    float mu = 1.0f / (2.0f * (1.0f + nu));
+
+    for (int e = 0; e < m; e++) {
+        for (int a = 0; a < 4; a++)
+            restCorners[4 * e + a] = points.x[tets[e].v[a]];
+        const vec3* X = &restCorners[4 * e];
+        mat3 Dm(X[1] - X[0], X[2] - X[0], X[3] - X[0]);
+        float volume = std::fabs(determinant(Dm)) / 6.0f;
+        restInverse[e] = inverse(Dm);
+
+        // gradients of the linear shape functions are the rows of Dm^-1
+        mat3 rows = transpose(restInverse[e]);
+        vec3 g[4] = { -(rows[0] + rows[1] + rows[2]), rows[0], rows[1], rows[2] };
+        // K_ab = V (lambda g_a g_b^T + mu g_b g_a^T + mu (g_a . g_b) I)
+        for (int a = 0; a < 4; a++)
+            for (int b = 0; b < 4; b++)
+                stiffness[16 * e + 4 * a + b] = volume * (lambda * outerProduct(g[a], g[b])
+                    + mu * outerProduct(g[b], g[a]) + mu * dot(g[a], g[b]) * mat3(1.0f));
+    }
+
+    // the corners of every particle, in element order
+    cornerStart.assign(n + 1, 0);
+    for (int e = 0; e < m; e++)
+        for (int a = 0; a < 4; a++)
+            cornerStart[tets[e].v[a] + 1]++;
+    for (int i = 0; i < n; i++)
+        cornerStart[i + 1] += cornerStart[i];
+    corners.resize(4 * m);
+    vector<int> next(cornerStart.begin(), cornerStart.end() - 1);
+    for (int e = 0; e < m; e++)
+        for (int a = 0; a < 4; a++)
+            corners[next[tets[e].v[a]]++] = 4 * e + a;
+
+    pattern.clear();
+    for (int e = 0; e < m; e++)
+        for (int a = 0; a < 4; a++)
+            for (int b = a + 1; b < 4; b++)
+                pattern.push_back(make_pair(tets[e].v[a], tets[e].v[b]));
+    patternSource = BlockSparseMatrix::newPatternSource();
+}
+
+int CorotationalFem::elements() const {
+    return (int)tets.size();
+}
+
+void CorotationalFem::attach(ParticleSystem& points) {
+    CorotationalFem* model = this;
+    const ParticleSystem* system = &points;
+    points.forcing = [model, system](float t, const ParticleSystem::Vec3Array& x, const ParticleSystem::Vec3Array& v, ParticleSystem::Vec3Array& f) {
+        model->forces(*system, x, v, f);
+    };
+    points.forceJacobian = [model, system](float t, const ParticleSystem::Vec3Array& x, const ParticleSystem::Vec3Array& v, BlockSparseMatrix& dfdx, BlockSparseMatrix& dfdv) {
+        model->jacobians(*system, x, v, dfdx, dfdv);
+    };
+}
+
+void CorotationalFem::updateRotation(int e, const ParticleSystem::Vec3Array& x) {
+    const int* v = tets[e].v;
+    mat3 Ds(x[v[1]] - x[v[0]], x[v[2]] - x[v[0]], x[v[3]] - x[v[0]]);
+    extractRotation(Ds * restInverse[e], rotation[e]);
+}
+
+void CorotationalFem::forces(const ParticleSystem& points, const ParticleSystem::Vec3Array& x, const ParticleSystem::Vec3Array& v, ParticleSystem::Vec3Array& f) {
+    float E = youngModulus * kFactor;
+    float beta = dampFactor * dampingScale;
+
+    // f_a = -E R sum_b K_ab (R^T x_b - X_b + beta R^T v_b)
+    points.parallel(elements(), [&](int begin, int end) {
+        for (int e = begin; e < end; e++) {
+            updateRotation(e, x);
+            mat3 R = mat3_cast(rotation[e]);
+            mat3 Rt = transpose(R);
+            vec3 u[4];
+            for (int b = 0; b < 4; b++) {
+                int i = tets[e].v[b];
+                u[b] = Rt * (x[i] + beta * v[i]) - restCorners[4 * e + b];
+            }
+            for (int a = 0; a < 4; a++) {
+                vec3 sum(0.0f);
+                for (int b = 0; b < 4; b++)
+                    sum += stiffness[16 * e + 4 * a + b] * u[b];
+                cornerForces[4 * e + a] = -E * (R * sum);
+            }
+        }
+    });
+
+    points.parallel([&](int begin, int end) {
+        for (int i = begin; i < end; i++) {
+            vec3 force(0.0f);
+            for (int k = cornerStart[i]; k < cornerStart[i + 1]; k++)
+                force += cornerForces[corners[k]];
+            force.y -= points.mass(i) * gravity;
+            f[i] = force;
+        }
+    });
+}
+
+void CorotationalFem::buildBlockSources(const BlockSparseMatrix& dfdx) {
+    int blocks = (int)dfdx.blocks.size();
+    vector<int> target(rotatedBlocks.size());
+    blockStart.assign(blocks + 1, 0);
+    for (int e = 0; e < elements(); e++)
+        for (int a = 0; a < 4; a++)
+            for (int b = 0; b < 4; b++) {
+                int k = dfdx.blockIndex(tets[e].v[a], tets[e].v[b]);
+                target[16 * e + 4 * a + b] = k;
+                blockStart[k + 1]++;
+            }
+    for (int k = 0; k < blocks; k++)
+        blockStart[k + 1] += blockStart[k];
+    blockSources.resize(target.size());
+    vector<int> next(blockStart.begin(), blockStart.end() - 1);
+    for (int s = 0; s < target.size(); s++)
+        blockSources[next[target[s]]++] = s;
+}
+
+void CorotationalFem::jacobians(const ParticleSystem& points, const ParticleSystem::Vec3Array& x, const ParticleSystem::Vec3Array& v, BlockSparseMatrix& dfdx, BlockSparseMatrix& dfdv) {
+    int n = points.size();
+    // the pattern only depends on the elements, it is set again when they
+    // change or when dfdx was given another pattern meanwhile
+    if (dfdx.size() != n || dfdx.patternSource != patternSource) {
+        dfdx.setPattern(n, pattern, patternSource);
+        dfdv.setPattern(n, pattern, patternSource);
+        buildBlockSources(dfdx);
+    }
+    float E = youngModulus * kFactor;
+    float beta = dampFactor * dampingScale;
+
+    // df_a / dx_b = -E R K_ab R^T
+    points.parallel(elements(), [&](int begin, int end) {
+        for (int e = begin; e < end; e++) {
+            updateRotation(e, x);
+            mat3 R = mat3_cast(rotation[e]);
+            mat3 Rt = transpose(R);
+            for (int k = 0; k < 16; k++)
+                rotatedBlocks[16 * e + k] = -E * (R * stiffness[16 * e + k] * Rt);
+        }
+    });
+
+    // every block row gathers its element blocks, df/dv is beta df/dx
+    points.parallel([&](int begin, int end) {
+        for (int i = begin; i < end; i++)
+            for (int k = dfdx.rowStart[i]; k < dfdx.rowStart[i + 1]; k++) {
+                mat3 sum(0.0f);
+                for (int s = blockStart[k]; s < blockStart[k + 1]; s++)
+                    sum += rotatedBlocks[blockSources[s]];
+                dfdx.blocks[k] = sum;
+                dfdv.blocks[k] = beta * sum;
+            }
+    });
+}
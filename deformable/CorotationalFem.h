@@ -0,0 +1,81 @@
+#ifndef COROTATIONAL_FEM_H
+#define COROTATIONAL_FEM_H
+
+#include <vector>
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+#include "ParticleSystem.h"
+
+/**
+* Co-rotational linear finite elements on tetrahedra (Mueller and Gross 2004).
+* Every element keeps the stiffness matrix of linear elasticity of its rest
+* shape and applies it in a frame rotated with the element, the rotation
+* being the polar part of the deformation gradient. The forces are linear in
+* the positions for fixed rotations, so df/dx is the rotated stiffness, and
+* damping is proportional to it.
+*
+* The model plugs into the particle system like the springs do, so every
+* integrator works, implicit Euler with the conjugate gradient solver being
+* the one meant for it. The pattern of the global matrix is built once; a
+* step only rewrites its blocks. Element forces and blocks are computed in
+* parallel and gathered per particle in a fixed order.
+*/
+class CorotationalFem {
+public:
+    struct Tetrahedron {
+        int v[4];
+    };
+
+    // Young's modulus is youngModulus * kFactor, damping is dampFactor *
+    // dampingScale times the stiffness
+    float youngModulus;
+    float poissonRatio;
+    float dampingScale;
+    float kFactor;
+    float dampFactor;
+
+    CorotationalFem();
+    /**
+    * Tetrahedralizes a closed triangle surface by joining every triangle to
+    * the centroid of the vertices, which is appended as an interior point.
+    * Needs an outward oriented surface that is star-shaped from the
+    * centroid, which the cube, sphere and cylinder are; false otherwise.
+    */
+    static bool tetrahedralize(const ParticleSystem::Vec3Array& surface, const std::vector<int>& triangles,
+                               ParticleSystem::Vec3Array& interior, std::vector<Tetrahedron>& tets);
+    /** Takes the tetrahedra at the current positions of points as the rest shape */
+    void setElements(const ParticleSystem& points, const std::vector<Tetrahedron>& tets);
+    /** Number of elements */
+    int elements() const;
+    /** Sets the forcing and force Jacobian of points to this model */
+    void attach(ParticleSystem& points);
+    void forces(const ParticleSystem& points, const ParticleSystem::Vec3Array& x, const ParticleSystem::Vec3Array& v, ParticleSystem::Vec3Array& f);
+    void jacobians(const ParticleSystem& points, const ParticleSystem::Vec3Array& x, const ParticleSystem::Vec3Array& v, BlockSparseMatrix& dfdx, BlockSparseMatrix& dfdv);
+
+private:
+    std::vector<Tetrahedron> tets;
+    // rest positions of the corners and the inverse rest edge matrix of every element
+    std::vector<glm::vec3> restCorners;
+    std::vector<glm::mat3> restInverse;
+    // 4 x 4 blocks of the rest stiffness at E = 1 of every element, row major
+    std::vector<glm::mat3> stiffness;
+    // rotation of every element, warm start of the next extraction
+    std::vector<glm::quat> rotation;
+    // per element corner forces and rotated stiffness blocks before the gather
+    std::vector<glm::vec3> cornerForces;
+    std::vector<glm::mat3> rotatedBlocks;
+    // corners of particle i are corners[cornerStart[i]..cornerStart[i + 1]), as 4 * element + corner
+    std::vector<int> cornerStart, corners;
+    // matrix pattern and, for every matrix block, the element blocks summed into it
+    std::vector<std::pair<int, int> > pattern;
+    std::vector<int> blockStart, blockSources;
+    // pattern source of the elements, new on every setElements
+    unsigned patternSource;
+
+    /** Rotation of element e at positions x */
+    void updateRotation(int e, const ParticleSystem::Vec3Array& x);
+    /** Builds the gather lists of the matrix blocks for the pattern of dfdx */
+    void buildBlockSources(const BlockSparseMatrix& dfdx);
+};
+
+#endif
@@ -0,0 +1,362 @@
+#include "FreeFormDeformation.h"
+#include <algorithm>
+#include <cmath>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define FFD_KERNELS_X86
+#include <immintrin.h>
+#endif
+
+#if defined(__GNUC__)
+#define SIMD_TARGET(isa) __attribute__((target(isa)))
+#else
+#define SIMD_TARGET(isa)
+#endif
+
+using namespace glm;
+using namespace std;
+
+// batches per chunk of the parallel loop
+static const int batchGrain = 16;
+
+/** Bernstein polynomials B_0^d(s)..B_d^d(s), by de Casteljau's recurrence */
+static void bernstein(int d, float s, float* b) {
+    b[0] = 1.0f;
+    for (int r = 1; r <= d; r++) {
+        b[r] = s * b[r - 1];
+        for (int i = r - 1; i > 0; i--)
+            b[i] = (1.0f - s) * b[i] + s * b[i - 1];
+        b[0] *= 1.0f - s;
+    }
+}
+
+static void batchScalar(const FfdLattice::Batch& b) {
+    const int L = FfdLattice::batchSize;
+    for (int v = 0; v < L; v++) {
+        float x = 0.0f, y = 0.0f, z = 0.0f;
+        int c = 0;
+        for (int k = 0; k <= b.dimension[2]; k++)
+            for (int j = 0; j <= b.dimension[1]; j++) {
+                float w = b.basis[1][j * L + v] * b.basis[2][k * L + v];
+                for (int i = 0; i <= b.dimension[0]; i++, c++) {
+                    float wi = b.basis[0][i * L + v] * w;
+                    x += wi * b.displacement[0][c];
+                    y += wi * b.displacement[1][c];
+                    z += wi * b.displacement[2][c];
+                }
+            }
+        b.out[0][v] = b.rest[0][v] + x;
+        b.out[1][v] = b.rest[1][v] + y;
+        b.out[2][v] = b.rest[2][v] + z;
+    }
+}
+
+#ifdef FFD_KERNELS_X86
+
+SIMD_TARGET("sse4.2")
+static void batchSse(const FfdLattice::Batch& b) {
+    const int L = FfdLattice::batchSize;
+    for (int v = 0; v < L; v += 4) {
+        __m128 x = _mm_setzero_ps(), y = _mm_setzero_ps(), z = _mm_setzero_ps();
+        int c = 0;
+        for (int k = 0; k <= b.dimension[2]; k++) {
+            __m128 bu = _mm_loadu_ps(b.basis[2] + k * L + v);
+            for (int j = 0; j <= b.dimension[1]; j++) {
+                __m128 w = _mm_mul_ps(_mm_loadu_ps(b.basis[1] + j * L + v), bu);
+                for (int i = 0; i <= b.dimension[0]; i++, c++) {
+                    __m128 wi = _mm_mul_ps(_mm_loadu_ps(b.basis[0] + i * L + v), w);
+                    x = _mm_add_ps(x, _mm_mul_ps(wi, _mm_set1_ps(b.displacement[0][c])));
+                    y = _mm_add_ps(y, _mm_mul_ps(wi, _mm_set1_ps(b.displacement[1][c])));
+                    z = _mm_add_ps(z, _mm_mul_ps(wi, _mm_set1_ps(b.displacement[2][c])));
+                }
+            }
+        }
+        _mm_storeu_ps(b.out[0] + v, _mm_add_ps(_mm_loadu_ps(b.rest[0] + v), x));
+        _mm_storeu_ps(b.out[1] + v, _mm_add_ps(_mm_loadu_ps(b.rest[1] + v), y));
+        _mm_storeu_ps(b.out[2] + v, _mm_add_ps(_mm_loadu_ps(b.rest[2] + v), z));
+    }
+}
+
+SIMD_TARGET("avx2")
+static void batchAvx2(const FfdLattice::Batch& b) {
+    const int L = FfdLattice::batchSize;
+    for (int v = 0; v < L; v += 8) {
+        __m256 x = _mm256_setzero_ps(), y = _mm256_setzero_ps(), z = _mm256_setzero_ps();
+        int c = 0;
+        for (int k = 0; k <= b.dimension[2]; k++) {
+            __m256 bu = _mm256_loadu_ps(b.basis[2] + k * L + v);
+            for (int j = 0; j <= b.dimension[1]; j++) {
+                __m256 w = _mm256_mul_ps(_mm256_loadu_ps(b.basis[1] + j * L + v), bu);
+                for (int i = 0; i <= b.dimension[0]; i++, c++) {
+                    __m256 wi = _mm256_mul_ps(_mm256_loadu_ps(b.basis[0] + i * L + v), w);
+                    x = _mm256_add_ps(x, _mm256_mul_ps(wi, _mm256_set1_ps(b.displacement[0][c])));
+                    y = _mm256_add_ps(y, _mm256_mul_ps(wi, _mm256_set1_ps(b.displacement[1][c])));
+                    z = _mm256_add_ps(z, _mm256_mul_ps(wi, _mm256_set1_ps(b.displacement[2][c])));
+                }
+            }
+        }
+        _mm256_storeu_ps(b.out[0] + v, _mm256_add_ps(_mm256_loadu_ps(b.rest[0] + v), x));
+        _mm256_storeu_ps(b.out[1] + v, _mm256_add_ps(_mm256_loadu_ps(b.rest[1] + v), y));
+        _mm256_storeu_ps(b.out[2] + v, _mm256_add_ps(_mm256_loadu_ps(b.rest[2] + v), z));
+    }
+}
+
+SIMD_TARGET("avx512f")
+static void batchAvx512(const FfdLattice::Batch& b) {
+    const int L = FfdLattice::batchSize;
+    __m512 x = _mm512_setzero_ps(), y = _mm512_setzero_ps(), z = _mm512_setzero_ps();
+    int c = 0;
+    for (int k = 0; k <= b.dimension[2]; k++) {
+        __m512 bu = _mm512_loadu_ps(b.basis[2] + k * L);
+        for (int j = 0; j <= b.dimension[1]; j++) {
+            __m512 w = _mm512_mul_ps(_mm512_loadu_ps(b.basis[1] + j * L), bu);
+            for (int i = 0; i <= b.dimension[0]; i++, c++) {
+                __m512 wi = _mm512_mul_ps(_mm512_loadu_ps(b.basis[0] + i * L), w);
+                x = _mm512_fmadd_ps(wi, _mm512_set1_ps(b.displacement[0][c]), x);
+                y = _mm512_fmadd_ps(wi, _mm512_set1_ps(b.displacement[1][c]), y);
+                z = _mm512_fmadd_ps(wi, _mm512_set1_ps(b.displacement[2][c]), z);
+            }
+        }
+    }
+    _mm512_storeu_ps(b.out[0], _mm512_add_ps(_mm512_loadu_ps(b.rest[0]), x));
+    _mm512_storeu_ps(b.out[1], _mm512_add_ps(_mm512_loadu_ps(b.rest[1]), y));
+    _mm512_storeu_ps(b.out[2], _mm512_add_ps(_mm512_loadu_ps(b.rest[2]), z));
+}
+
+#endif
+
+static FfdLattice::BatchKernel batchKernel(SimdLevel level) {
+#ifdef FFD_KERNELS_X86
+    switch (level) {
+    case SimdLevel::SSE42:
+        return batchSse;
+    case SimdLevel::AVX2:
+        return batchAvx2;
+    case SimdLevel::AVX512:
+        return batchAvx512;
+    default:
+        break;
+    }
+#endif
+    return batchScalar;
+}
+
+FfdLattice::FfdLattice() {
+    dropTolerance = 1e-6f;
+    moveTolerance = 1e-6f;
+    refreshInterval = 100;
+    threadPool = 0;
+    dimension[0] = dimension[1] = dimension[2] = 0;
+    vertexCount = 0;
+    setSimdLevel(detectSimdLevel());
+}
+
+void FfdLattice::setLattice(const vec3& lower, const vec3& upper, int l, int m, int n) {
+    dimension[0] = std::max(l, 1);
+    dimension[1] = std::max(m, 1);
+    dimension[2] = std::max(n, 1);
+    origin = lower;
+    extent = upper - lower;
+
+    restControl.resize(controlPoints());
+    for (int k = 0; k <= dimension[2]; k++)
+        for (int j = 0; j <= dimension[1]; j++)
+            for (int i = 0; i <= dimension[0]; i++)
+                restControl[index(i, j, k)] = origin + extent * vec3(float(i) / dimension[0],
+                    float(j) / dimension[1], float(k) / dimension[2]);
+    embed(vector<vec3>());
+}
+
+int FfdLattice::cells(int axis) const {
+    return dimension[axis];
+}
+
+int FfdLattice::controlPoints() const {
+    return (dimension[0] + 1) * (dimension[1] + 1) * (dimension[2] + 1);
+}
+
+int FfdLattice::index(int i, int j, int k) const {
+    return i + (dimension[0] + 1) * (j + (dimension[1] + 1) * k);
+}
+
+const vector<vec3>& FfdLattice::restControlPoints() const {
+    return restControl;
+}
+
+void FfdLattice::embed(const vector<vec3>& vertices) {
+    const int L = batchSize;
+    vertexCount = (int)vertices.size();
+    int batches = (vertexCount + L - 1) / L;
+    for (int a = 0; a < 3; a++) {
+        basis[a].assign(batches * (dimension[a] + 1) * L, 0.0f);
+        restSoa[a].assign(batches * L, 0.0f);
+    }
+
+    vector<float> b(*std::max_element(dimension, dimension + 3) + 1);
+    for (int v = 0; v < vertexCount; v++) {
+        int batch = v / L, lane = v % L;
+        for (int a = 0; a < 3; a++) {
+            // a flat box has a single parametric value across it
+            float s = extent[a] > 0.0f ? (vertices[v][a] - origin[a]) / extent[a] : 0.0f;
+            bernstein(dimension[a], s, &b[0]);
+            float* values = &basis[a][batch * (dimension[a] + 1) * L];
+            for (int i = 0; i <= dimension[a]; i++)
+                values[i * L + lane] = b[i];
+            restSoa[a][v] = vertices[v][a];
+        }
+    }
+
+    // the weight matrix by columns, counted first, vertices in order within a column
+    int n = controlPoints();
+    columnStart.assign(n + 1, 0);
+    for (int pass = 0; pass < 2; pass++) {
+        vector<int> next(columnStart.begin(), columnStart.end() - 1);
+        for (int v = 0; v < vertexCount; v++) {
+            int batch = v / L, lane = v % L;
+            const float* bs = &basis[0][batch * (dimension[0] + 1) * L + lane];
+            const float* bt = &basis[1][batch * (dimension[1] + 1) * L + lane];
+            const float* bu = &basis[2][batch * (dimension[2] + 1) * L + lane];
+            for (int k = 0; k <= dimension[2]; k++)
+                for (int j = 0; j <= dimension[1]; j++)
+                    for (int i = 0; i <= dimension[0]; i++) {
+                        float w = bs[i * L] * (bt[j * L] * bu[k * L]);
+                        if (std::fabs(w) < dropTolerance)
+                            continue;
+                        int c = index(i, j, k);
+                        if (pass == 0) {
+                            columnStart[c + 1]++;
+                            continue;
+                        }
+                        columnVertex[next[c]] = v;
+                        columnWeight[next[c]++] = w;
+                    }
+        }
+        if (pass == 0) {
+            for (int c = 0; c < n; c++)
+                columnStart[c + 1] += columnStart[c];
+            columnVertex.resize(columnStart[n]);
+            columnWeight.resize(columnStart[n]);
+        }
+    }
+
+    setRenderIndices(vector<int>());
+    applied = restControl;
+    incrementalUpdates = 0;
+}
+
+void FfdLattice::setRenderIndices(const vector<int>& indices) {
+    slotStart.assign(vertexCount + 1, 0);
+    if (indices.empty()) {
+        slots.resize(vertexCount);
+        for (int v = 0; v < vertexCount; v++) {
+            slotStart[v + 1] = v + 1;
+            slots[v] = v;
+        }
+        return;
+    }
+    for (int s = 0; s < indices.size(); s++)
+        slotStart[indices[s] + 1]++;
+    for (int v = 0; v < vertexCount; v++)
+        slotStart[v + 1] += slotStart[v];
+    slots.resize(indices.size());
+    vector<int> next(slotStart.begin(), slotStart.end() - 1);
+    for (int s = 0; s < indices.size(); s++)
+        slots[next[indices[s]]++] = s;
+}
+
+int FfdLattice::vertices() const {
+    return vertexCount;
+}
+
+int FfdLattice::outputs() const {
+    return (int)slots.size();
+}
+
+int FfdLattice::nonzeros() const {
+    return (int)columnWeight.size();
+}
+
+void FfdLattice::setSimdLevel(SimdLevel level) {
+    simd = level;
+    kernel = batchKernel(level);
+}
+
+SimdLevel FfdLattice::simdLevel() const {
+    return simd;
+}
+
+void FfdLattice::deform(const vector<vec3>& control, vector<vec3>& out) const {
+    const int L = batchSize;
+    int n = controlPoints();
+    for (int a = 0; a < 3; a++) {
+        displacement[a].resize(n);
+        for (int c = 0; c < n; c++)
+            displacement[a][c] = control[c][a] - restControl[c][a];
+    }
+    out.resize(outputs());
+
+    int batches = (vertexCount + L - 1) / L;
+    auto body = [&](int first, int last) {
+        float positions[3][L];
+        Batch b;
+        for (int a = 0; a < 3; a++) {
+            b.dimension[a] = dimension[a];
+            b.displacement[a] = &displacement[a][0];
+            b.out[a] = positions[a];
+        }
+        for (int batch = first; batch < last; batch++) {
+            for (int a = 0; a < 3; a++) {
+                b.basis[a] = &basis[a][batch * (dimension[a] + 1) * L];
+                b.rest[a] = &restSoa[a][batch * L];
+            }
+            kernel(b);
+            // every output slot belongs to one vertex, so batches write disjoint slots
+            int lanes = std::min(L, vertexCount - batch * L);
+            for (int lane = 0; lane < lanes; lane++) {
+                int v = batch * L + lane;
+                vec3 p(positions[0][lane], positions[1][lane], positions[2][lane]);
+                for (int s = slotStart[v]; s < slotStart[v + 1]; s++)
+                    out[slots[s]] = p;
+            }
+        }
+    };
+    if (threadPool)
+        threadPool->parallelFor(0, batches, batchGrain, cref(body));
+    else
+        body(0, batches);
+}
+
+bool FfdLattice::update(const vector<vec3>& control, vector<vec3>& out) {
+    moved.clear();
+    int movedWeights = 0;
+    for (int c = 0; c < controlPoints(); c++) {
+        vec3 d = control[c] - applied[c];
+        if (dot(d, d) > moveTolerance * moveTolerance) {
+            moved.push_back(c);
+            movedWeights += columnStart[c + 1] - columnStart[c];
+        }
+    }
+    bool stale = out.size() != outputs();
+    if (moved.empty() && !stale)
+        return false;
+
+    // past a quarter of the weights the batched product is cheaper than the scattered updates
+    if (stale || 4 * movedWeights > nonzeros() || ++incrementalUpdates > refreshInterval) {
+        deform(control, out);
+        applied = control;
+        incrementalUpdates = 0;
+        return true;
+    }
+    for (int m = 0; m < moved.size(); m++) {
+        int c = moved[m];
+        vec3 d = control[c] - applied[c];
+        for (int k = columnStart[c]; k < columnStart[c + 1]; k++) {
+            int v = columnVertex[k];
+            vec3 move = columnWeight[k] * d;
+            for (int s = slotStart[v]; s < slotStart[v + 1]; s++)
+                out[slots[s]] += move;
+        }
+        applied[c] = control[c];
+    }
+    return true;
+}
@@ -0,0 +1,126 @@
+#ifndef FREE_FORM_DEFORMATION_H
+#define FREE_FORM_DEFORMATION_H
+
+#include <vector>
+#include <glm/glm.hpp>
+#include <common/threadpool.h>
+#include "ParticleSystem.h"
+#include "SpringKernels.h"
+
+/**
+* Free form deformation (Sederberg and Parry 1986) with a trivariate
+* Bernstein lattice of l x m x n cells, (l + 1)(m + 1)(n + 1) control points,
+* spanning a box. A point with parametric coordinates (s, t, u) in the box
+* follows sum_ijk B_i^l(s) B_j^m(t) B_k^n(u) P_ijk. It is evaluated on the
+* control point displacements and added to the rest vertices, which keeps
+* the rest shape exact.
+*
+* The Bernstein values of every embedded vertex along the three axes are
+* computed once. A full deformation runs over batches of 16 vertices, in
+* parallel on the thread pool, with the vertices of a batch in the lanes of
+* SSE4.2, AVX2 or AVX-512 registers: every lane visits the control points in
+* the same order, so a displacement is broadcast and no gathers are needed.
+* Every lane sums in the same order; the AVX-512 kernel fuses the multiply
+* adds, so it differs from the others by rounding, about 1e-7 on the teapot.
+* For a given instruction set the results are reproducible bit for bit.
+*
+* The full product is dense by design: Bernstein polynomials have global
+* support, so every control point weighs on every vertex, and with a few
+* cells per axis nearly all weights stay above dropTolerance (20.7M of 25M
+* for random points in a 4^3 lattice). The kernels therefore skip nothing.
+* The sparse weight matrix only serves the incremental path: update() keeps
+* the control positions it last applied and, when few moved since, only
+* touches the vertices of those through the transposed weight matrix,
+* adding the weight times the move.
+*
+* The output can be the triangle corner buffer the renderer draws: with
+* render indices every vertex is written to each of its corners directly.
+*/
+class FfdLattice {
+public:
+    // vertices evaluated together by the kernels
+    static const int batchSize = 16;
+
+    // weights below this are left out of the matrix of update()
+    float dropTolerance;
+    // control points that moved less than this since the last update are left for later
+    float moveTolerance;
+    // incremental updates between full products, which clear the rounding they accumulate
+    int refreshInterval;
+    // pool for the full deformation, none runs it on the calling thread
+    ThreadPool* threadPool;
+
+    FfdLattice();
+    /** Places a lattice of l x m x n cells on the box lower..upper, at rest */
+    void setLattice(const glm::vec3& lower, const glm::vec3& upper, int l, int m, int n);
+    /** Cells along axis 0, 1 or 2 */
+    int cells(int axis) const;
+    /** Number of control points */
+    int controlPoints() const;
+    /** Index of control point (i, j, k), i running fastest */
+    int index(int i, int j, int k) const;
+    /** Rest positions of the control points */
+    const std::vector<glm::vec3>& restControlPoints() const;
+    /** Computes the parametric coordinates and weights of the vertices at rest */
+    void embed(const std::vector<glm::vec3>& vertices);
+    /**
+    * Makes the output out[s] = vertex indices[s] for every s, like a
+    * triangle list expanded for drawing; an empty list writes vertex v to
+    * out[v]. Set after embed.
+    */
+    void setRenderIndices(const std::vector<int>& indices);
+    /** Number of embedded vertices */
+    int vertices() const;
+    /** Size of the output */
+    int outputs() const;
+    /** Weights kept in the matrix of update() */
+    int nonzeros() const;
+    /** Instruction set of the kernel, detected at construction */
+    void setSimdLevel(SimdLevel level);
+    SimdLevel simdLevel() const;
+    /** Output for the control points, from scratch */
+    void deform(const std::vector<glm::vec3>& control, std::vector<glm::vec3>& out) const;
+    /**
+    * Brings out, the output of the last update or the rest shape after
+    * embed, to the control points by moving only the vertices of the control
+    * points that moved. False if none did and out is unchanged.
+    */
+    bool update(const std::vector<glm::vec3>& control, std::vector<glm::vec3>& out);
+
+    /** Vertices of a batch and the control point displacements they follow, for the kernels */
+    struct Batch {
+        // Bernstein values along x, y and z, value i of lane v at [i * batchSize + v]
+        const float* basis[3];
+        int dimension[3];
+        // rest positions of the lanes and displacements of the control points, by coordinate
+        const float* rest[3];
+        const float* displacement[3];
+        // positions of the lanes, by coordinate
+        float* out[3];
+    };
+    typedef void (*BatchKernel)(const Batch& batch);
+
+private:
+    int dimension[3];
+    glm::vec3 origin, extent;
+    std::vector<glm::vec3> restControl;
+    int vertexCount;
+    // per batch the Bernstein values of every axis and the rest positions by coordinate, padded lanes are zero
+    ParticleSystem::Array<float> basis[3], restSoa[3];
+    // the transpose of the weight matrix: control point c moves vertex
+    // columnVertex[k] by columnWeight[k] for k in columnStart[c]..columnStart[c + 1]
+    std::vector<int> columnStart, columnVertex;
+    std::vector<float> columnWeight;
+    // outputs of vertex v are slots[slotStart[v]..slotStart[v + 1])
+    std::vector<int> slotStart, slots;
+    SimdLevel simd;
+    BatchKernel kernel;
+    // control point displacements by coordinate for the kernels
+    mutable ParticleSystem::Array<float> displacement[3];
+    // control positions the output of the last update follows, and the ones moved since
+    std::vector<glm::vec3> applied;
+    std::vector<int> moved;
+    int incrementalUpdates;
+};
+
+#endif
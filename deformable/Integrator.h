@@ -0,0 +1,121 @@
+#ifndef INTEGRATOR_H
+#define INTEGRATOR_H
+
+#include <array>
+
+/**
+* Fixed-size state vector. It lives on the stack, so the integrators below
+* never touch the heap.
+*/
+template<int N>
+using State = std::array<float, N>;
+
+/**
+* Integration schemes. The symplectic ones (symplectic Euler and the two
+* Verlet variants) need a single force evaluation per step and keep the
+* energy of spring systems bounded at much larger steps than Euler.
+* Implicit Euler also needs the force Jacobian and stays stable for any
+* stiffness. Dormand-Prince 5(4) picks its own substeps from an embedded
+* error estimate. Only ParticleSystem implements these last two.
+*/
+enum class IntegrationMethod {
+    EULER,
+    RUNGE_KUTTA_4,
+    SYMPLECTIC_EULER,
+    VELOCITY_VERLET,
+    POSITION_VERLET,
+    IMPLICIT_EULER,
+    DORMAND_PRINCE,
+    COUNT
+};
+
+/** Human readable name of an integration method */
+inline const char* integrationMethodName(IntegrationMethod method) {
+    switch (method) {
+    case IntegrationMethod::EULER: return "Euler";
+    case IntegrationMethod::RUNGE_KUTTA_4: return "Runge-Kutta 4th";
+    case IntegrationMethod::SYMPLECTIC_EULER: return "Symplectic Euler";
+    case IntegrationMethod::VELOCITY_VERLET: return "Velocity Verlet";
+    case IntegrationMethod::POSITION_VERLET: return "Position Verlet";
+    case IntegrationMethod::IMPLICIT_EULER: return "Implicit Euler";
+    case IntegrationMethod::DORMAND_PRINCE: return "Dormand-Prince 5(4)";
+    default: return "Unknown";
+    }
+}
+
+/** The method after the given one, wrapping around */
+inline IntegrationMethod nextIntegrationMethod(IntegrationMethod method) {
+    int next = ((int)method + 1) % (int)IntegrationMethod::COUNT;
+    return (IntegrationMethod)next;
+}
+
+/** Work done by an adaptive integrator since the last reset */
+struct StepStatistics {
+    int acceptedSteps = 0;
+    int rejectedSteps = 0;
+    int forceEvaluations = 0;
+    float minStep = 0.0f;
+    float maxStep = 0.0f;
+    float simulatedTime = 0.0f;
+
+    void reset() { *this = StepStatistics(); }
+    void accept(float h) {
+        minStep = acceptedSteps == 0 ? h : (h < minStep ? h : minStep);
+        maxStep = acceptedSteps == 0 ? h : (h > maxStep ? h : maxStep);
+        acceptedSteps++;
+        simulatedTime += h;
+    }
+    float averageStep() const { return acceptedSteps == 0 ? 0.0f : simulatedTime / acceptedSteps; }
+    /** Force evaluations per simulated second */
+    float work() const { return simulatedTime == 0.0f ? 0.0f : forceEvaluations / simulatedTime; }
+};
+
+/**
+* Euler method for advancing the state y(t + h) = y(t) + h dy(t) / dt.
+* dydt is any callable State<N>(float t, const State<N>& y).
+*/
+template<int N, typename Derivative>
+State<N> integrateEuler(const Derivative& dydt, float t, float h, const State<N>& y0) {
+    State<N> dydt0 = dydt(t, y0);
+    State<N> y1;
+    for (int i = 0; i < N; i++) {
+        y1[i] = y0[i] + h * dydt0[i];
+    }
+    return y1;
+}
+
+/** Runge-Kutta 4th order for advancing the state (error/step ~ O(h^5) */
+template<int N, typename Derivative>
+State<N> integrateRungeKutta4(const Derivative& dydt, float t, float h, const State<N>& y0) {
+    State<N> y;
+
+    // dydt0 = dydt(y0)
+    State<N> dydt0 = dydt(t, y0);
+
+    // y1 = y0 + h * dydt0 / 2
+    for (int i = 0; i < N; i++) {
+        y[i] = y0[i] + h * dydt0[i] / 2.0f;
+    }
+    State<N> dydt1 = dydt(t + h / 2.0f, y);
+
+    // y2 = y0 + h * dydt1 / 2
+    for (int i = 0; i < N; i++) {
+        y[i] = y0[i] + h * dydt1[i] / 2.0f;
+    }
+    State<N> dydt2 = dydt(t + h / 2.0f, y);
+
+    // y3 = y0 + h * dydt2
+    for (int i = 0; i < N; i++) {
+        y[i] = y0[i] + h * dydt2[i];
+    }
+    State<N> dydt3 = dydt(t + h, y);
+
+    // combine them to estimate the solution.
+    for (int i = 0; i < N; i++) {
+        y[i] = y0[i] + h * (dydt0[i] + 2.0f * dydt1[i]
+                            + 2.0f * dydt2[i] + dydt3[i]) / 6.0f;
+    }
+    return y;
+}
+
+#endif
@@ -0,0 +1,465 @@
+#include "ModalReduction.h"
+#include "Collision.h"
+#include "Point-Spring-Handling.h"
+#include "CacheFile.h"
+#include <cstdio>
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+
+using namespace glm;
+using namespace std;
+
+namespace {
+    // dense column-major matrices of the Rayleigh-Ritz step
+    typedef vector<double> Dense;
+
+    /** Eigenvalues and vectors (columns of V) of the symmetric m x m matrix C by cyclic Jacobi */
+    void jacobiEigen(int m, Dense& C, vector<double>& w, Dense& V) {
+        V.assign(m * m, 0.0);
+        for (int i = 0; i < m; i++)
+            V[i * m + i] = 1.0;
+        for (int sweep = 0; sweep < 50; sweep++) {
+            double off = 0.0, diagonal = 0.0;
+            for (int p = 0; p < m; p++) {
+                diagonal += C[p * m + p] * C[p * m + p];
+                for (int r = p + 1; r < m; r++)
+                    off += C[r * m + p] * C[r * m + p];
+            }
+            if (off <= 1e-24 * diagonal)
+                break;
+            for (int p = 0; p < m; p++)
+                for (int r = p + 1; r < m; r++) {
+                    double apr = C[r * m + p];
+                    if (std::fabs(apr) < 1e-300)
+                        continue;
+                    double theta = (C[r * m + r] - C[p * m + p]) / (2.0 * apr);
+                    double t = (theta >= 0.0 ? 1.0 : -1.0) / (std::fabs(theta) + std::sqrt(theta * theta + 1.0));
+                    double c = 1.0 / std::sqrt(t * t + 1.0), s = t * c;
+                    for (int k = 0; k < m; k++) {
+                        double ckp = C[p * m + k], ckr = C[r * m + k];
+                        C[p * m + k] = c * ckp - s * ckr;
+                        C[r * m + k] = s * ckp + c * ckr;
+                    }
+                    for (int k = 0; k < m; k++) {
+                        double cpk = C[k * m + p], crk = C[k * m + r];
+                        C[k * m + p] = c * cpk - s * crk;
+                        C[k * m + r] = s * cpk + c * crk;
+                    }
+                    for (int k = 0; k < m; k++) {
+                        double vkp = V[p * m + k], vkr = V[r * m + k];
+                        V[p * m + k] = c * vkp - s * vkr;
+                        V[r * m + k] = s * vkp + c * vkr;
+                    }
+                }
+        }
+        w.resize(m);
+        for (int i = 0; i < m; i++)
+            w[i] = C[i * m + i];
+    }
+
+    const char modalMagic[8] = { 'M', 'O', 'D', 'E', 'S', '0', '0', '1' };
+}
+
+ModalReduction::ModalReduction() {
+    dampingRatio = 0.05f;
+    kFactor = 1.0f;
+    dampFactor = 1.0f;
+    cached = false;
+    particles = 0;
+    totalMass = 0.0f;
+}
+
+int ModalReduction::modes() const {
+    return (int)eigenvalues.size();
+}
+
+float ModalReduction::eigenvalue(int j) const {
+    return eigenvalues[j];
+}
+
+unsigned long long ModalReduction::hash(const ParticleSystem& points, const BlockSparseMatrix& dfdx, int modes) {
+    unsigned long long h = hashSeed;
+    hashBytes(h, modalMagic, sizeof(modalMagic));
+    hashBytes(h, &modes, sizeof(modes));
+    hashBytes(h, points.x.data(), points.x.size() * sizeof(vec3));
+    hashBytes(h, points.invM.data(), points.invM.size() * sizeof(float));
+    hashBytes(h, dfdx.rowStart.data(), dfdx.rowStart.size() * sizeof(int));
+    hashBytes(h, dfdx.col.data(), dfdx.col.size() * sizeof(int));
+    hashBytes(h, dfdx.blocks.data(), dfdx.blocks.size() * sizeof(mat3));
+    return h;
+}
+
+bool ModalReduction::reduce(const ParticleSystem& points, const BlockSparseMatrix& dfdx, int modes, const string& cacheDirectory) {
+    unsigned long long key = hash(points, dfdx, modes);
+    string path = cachePath(cacheDirectory, "modes", key);
+
+    cached = load(path, key, points.size(), modes);
+    if (cached)
+        return true;
+    if (!solve(points, dfdx, modes))
+        return false;
+    save(path, key);
+    return true;
+}
+
+bool ModalReduction::solve(const ParticleSystem& points, const BlockSparseMatrix& dfdx, int modes) {
+    int n = points.size();
+    int dofs = 3 * n;
+    modes = std::min(modes, dofs - 6);
+    int m = std::min(modes + 8, dofs - 6);
+    if (modes <= 0)
+        return false;
+
+    vector<double> mass(dofs);
+    double meanMass = 0.0, meanStiffness = 0.0;
+    for (int i = 0; i < n; i++) {
+        for (int c = 0; c < 3; c++)
+            mass[3 * i + c] = points.mass(i);
+        meanMass += points.mass(i);
+        mat3 d = dfdx.blocks[dfdx.blockIndex(i, i)];
+        meanStiffness -= d[0][0] + d[1][1] + d[2][2];
+    }
+    meanMass /= n;
+    meanStiffness /= dofs;
+
+    // scalar K = -df/dx by rows, which for a symmetric matrix are its columns too,
+    // and A = K + sigma M, shifted so that the rigid motions do not make it singular
+    double sigma = 1e-3 * meanStiffness / meanMass;
+    vector<int> colStart(1, 0), row;
+    vector<double> stiffness;
+    vector<float> shifted;
+    for (int i = 0; i < n; i++)
+        for (int r = 0; r < 3; r++) {
+            for (int k = dfdx.rowStart[i]; k < dfdx.rowStart[i + 1]; k++)
+                for (int c = 0; c < 3; c++) {
+                    int j = 3 * dfdx.col[k] + c;
+                    double value = -dfdx.blocks[k][c][r];
+                    row.push_back(j);
+                    stiffness.push_back(value);
+                    shifted.push_back(float(value + (j == 3 * i + r ? sigma * mass[j] : 0.0)));
+                }
+            colStart.push_back((int)row.size());
+        }
+    SparseLDLT factorization;
+    factorization.analyze(dofs, colStart, row);
+    if (!factorization.factorize(shifted))
+        return false;
+
+    // M-orthonormal rigid motions: translations and rotations about the centre of mass
+    vec3 cm(0.0f);
+    float total = 0.0f;
+    for (int i = 0; i < n; i++) {
+        cm += points.mass(i) * points.x[i];
+        total += points.mass(i);
+    }
+    cm /= total;
+    vector<Dense> rigid;
+    for (int a = 0; a < 6; a++) {
+        Dense r(dofs);
+        for (int i = 0; i < n; i++) {
+            vec3 axis(0.0f);
+            axis[a % 3] = 1.0f;
+            vec3 u = a < 3 ? axis : cross(axis, points.x[i] - cm);
+            for (int c = 0; c < 3; c++)
+                r[3 * i + c] = u[c];
+        }
+        for (int b = 0; b < rigid.size(); b++) {
+            double d = 0.0;
+            for (int k = 0; k < dofs; k++)
+                d += rigid[b][k] * mass[k] * r[k];
+            for (int k = 0; k < dofs; k++)
+                r[k] -= d * rigid[b][k];
+        }
+        double norm = 0.0;
+        for (int k = 0; k < dofs; k++)
+            norm += r[k] * mass[k] * r[k];
+        // collinear particles have fewer rigid rotations
+        if (norm < 1e-12 * total)
+            continue;
+        for (int k = 0; k < dofs; k++)
+            r[k] /= std::sqrt(norm);
+        rigid.push_back(r);
+    }
+
+    // subspace iteration from a fixed pseudo-random start
+    Dense X(dofs * m), Y(dofs * m), KY(dofs * m), Kr(m * m), Mr(m * m), L(m * m), C(m * m), Z, V(m * m);
+    unsigned seed = 12345u;
+    for (int k = 0; k < X.size(); k++) {
+        seed = seed * 1664525u + 1013904223u;
+        X[k] = double(seed >> 8) / double(1 << 24) - 0.5;
+    }
+    vector<double> w, previous(m, 0.0), column(dofs);
+    bool converged = false;
+    for (int it = 0; it < 200 && !converged; it++) {
+        // Y = A^-1 M X, with the rigid motions removed
+        for (int j = 0; j < m; j++) {
+            for (int k = 0; k < dofs; k++)
+                column[k] = mass[k] * X[j * dofs + k];
+            factorization.solve(column);
+            for (int b = 0; b < rigid.size(); b++) {
+                double d = 0.0;
+                for (int k = 0; k < dofs; k++)
+                    d += rigid[b][k] * mass[k] * column[k];
+                for (int k = 0; k < dofs; k++)
+                    column[k] -= d * rigid[b][k];
+            }
+            copy(column.begin(), column.end(), Y.begin() + j * dofs);
+        }
+
+        // Rayleigh-Ritz: Kr = Y^T K Y, Mr = Y^T M Y
+        for (int j = 0; j < m; j++)
+            for (int r = 0; r < dofs; r++) {
+                double sum = 0.0;
+                for (int p = colStart[r]; p < colStart[r + 1]; p++)
+                    sum += stiffness[p] * Y[j * dofs + row[p]];
+                KY[j * dofs + r] = sum;
+            }
+        for (int a = 0; a < m; a++)
+            for (int b = 0; b <= a; b++) {
+                double k = 0.0, mm = 0.0;
+                for (int r = 0; r < dofs; r++) {
+                    k += Y[a * dofs + r] * KY[b * dofs + r];
+                    mm += Y[a * dofs + r] * mass[r] * Y[b * dofs + r];
+                }
+                Kr[b * m + a] = Kr[a * m + b] = k;
+                Mr[b * m + a] = Mr[a * m + b] = mm;
+            }
+
+        // Mr = L L^T, C = L^-1 Kr L^-T, eigenvectors of the pencil are L^-T Z
+        fill(L.begin(), L.end(), 0.0);
+        for (int j = 0; j < m; j++) {
+            double d = Mr[j * m + j];
+            for (int k = 0; k < j; k++)
+                d -= L[k * m + j] * L[k * m + j];
+            if (d <= 0.0)
+                return false;
+            L[j * m + j] = std::sqrt(d);
+            for (int i = j + 1; i < m; i++) {
+                double s = Mr[j * m + i];
+                for (int k = 0; k < j; k++)
+                    s -= L[k * m + i] * L[k * m + j];
+                L[j * m + i] = s / L[j * m + j];
+            }
+        }
+        // C = L^-1 Kr L^-T by forward substitution on the columns, twice
+        C = Kr;
+        for (int pass = 0; pass < 2; pass++) {
+            for (int col = 0; col < m; col++)
+                for (int i = 0; i < m; i++) {
+                    double s = C[col * m + i];
+                    for (int k = 0; k < i; k++)
+                        s -= L[k * m + i] * C[col * m + k];
+                    C[col * m + i] = s / L[i * m + i];
+                }
+            // transpose, so the second pass applies L^-1 from the other side
+            for (int a = 0; a < m; a++)
+                for (int b = a + 1; b < m; b++)
+                    swap(C[b * m + a], C[a * m + b]);
+        }
+        jacobiEigen(m, C, w, Z);
+        // V = L^-T Z by back substitution
+        for (int col = 0; col < m; col++)
+            for (int i = m - 1; i >= 0; i--) {
+                double s = Z[col * m + i];
+                for (int k = i + 1; k < m; k++)
+                    s -= L[i * m + k] * V[col * m + k];
+                V[col * m + i] = s / L[i * m + i];
+            }
+
+        // ascending eigenvalues, X = Y V
+        vector<int> order(m);
+        for (int j = 0; j < m; j++)
+            order[j] = j;
+        sort(order.begin(), order.end(), [&](int a, int b) { return w[a] < w[b]; });
+        for (int j = 0; j < m; j++)
+            for (int r = 0; r < dofs; r++) {
+                double sum = 0.0;
+                for (int k = 0; k < m; k++)
+                    sum += Y[k * dofs + r] * V[order[j] * m + k];
+                X[j * dofs + r] = sum;
+            }
+        converged = it > 0;
+        for (int j = 0; j < modes; j++) {
+            double lambda = w[order[j]];
+            converged = converged && std::fabs(lambda - previous[j]) <= 1e-6 * std::fabs(lambda);
+            previous[j] = lambda;
+        }
+    }
+
+    particles = n;
+    eigenvalues.resize(modes);
+    shapes.resize(modes * n);
+    for (int j = 0; j < modes; j++) {
+        eigenvalues[j] = float(std::max(previous[j], 0.0));
+        for (int i = 0; i < n; i++)
+            shapes[j * n + i] = vec3(X[j * dofs + 3 * i], X[j * dofs + 3 * i + 1], X[j * dofs + 3 * i + 2]);
+    }
+    return true;
+}
+
+bool ModalReduction::load(const string& path, unsigned long long key, int n, int modes) {
+    FILE* file = fopen(path.c_str(), "rb");
+    if (file == NULL)
+        return false;
+    char magic[8];
+    unsigned long long storedKey = 0;
+    int storedParticles = 0, storedModes = 0;
+    bool ok = fread(magic, 1, 8, file) == 8 && memcmp(magic, modalMagic, 8) == 0
+        && fread(&storedKey, sizeof(storedKey), 1, file) == 1 && storedKey == key
+        && fread(&storedParticles, sizeof(int), 1, file) == 1 && storedParticles == n
+        && fread(&storedModes, sizeof(int), 1, file) == 1 && storedModes > 0 && storedModes <= modes;
+    if (ok) {
+        eigenvalues.resize(storedModes);
+        shapes.resize(storedModes * n);
+        ok = fread(eigenvalues.data(), sizeof(float), storedModes, file) == storedModes
+            && fread(shapes.data(), sizeof(vec3), shapes.size(), file) == shapes.size();
+    }
+    fclose(file);
+    if (ok)
+        particles = n;
+    else {
+        eigenvalues.clear();
+        shapes.clear();
+    }
+    return ok;
+}
+
+bool ModalReduction::save(const string& path, unsigned long long key) const {
+    FILE* file = fopen(path.c_str(), "wb");
+    if (file == NULL)
+        return false;
+    int storedModes = modes();
+    bool ok = fwrite(modalMagic, 1, 8, file) == 8
+        && fwrite(&key, sizeof(key), 1, file) == 1
+        && fwrite(&particles, sizeof(int), 1, file) == 1
+        && fwrite(&storedModes, sizeof(int), 1, file) == 1
+        && fwrite(eigenvalues.data(), sizeof(float), storedModes, file) == storedModes
+        && fwrite(shapes.data(), sizeof(vec3), shapes.size(), file) == shapes.size();
+    fclose(file);
+    return ok;
+}
+
+void ModalReduction::reset(const ParticleSystem& points) {
+    int n = points.size();
+    masses.resize(n);
+    totalMass = 0.0f;
+    center = vec3(0.0f);
+    for (int i = 0; i < n; i++) {
+        masses[i] = points.mass(i);
+        totalMass += masses[i];
+        center += masses[i] * points.x[i];
+    }
+    center /= totalMass;
+
+    restOffset.resize(n);
+    mat3 inertia(0.0f);
+    for (int i = 0; i < n; i++) {
+        vec3 r = points.x[i] - center;
+        restOffset[i] = r;
+        inertia += masses[i] * (dot(r, r) * mat3(1.0f) - outerProduct(r, r));
+    }
+    invInertia = inverse(inertia);
+
+    velocity = vec3(0.0f);
+    angularMomentum = vec3(0.0f);
+    orientation = quat(1.0f, 0.0f, 0.0f, 0.0f);
+    q.assign(modes(), 0.0f);
+    qDot.assign(modes(), 0.0f);
+    offset.resize(n);
+    offsetVelocity.resize(n);
+    xBefore.resize(n);
+    vBefore.resize(n);
+}
+
+mat3 ModalReduction::worldInvInertia() const {
+    mat3 R = mat3_cast(orientation);
+    return R * invInertia * transpose(R);
+}
+
+void ModalReduction::advanceState(ParticleSystem& points, float h) {
+    // rigid motion: gravity moves the centre only, the body spins freely
+    velocity.y -= gravity * h;
+    center += h * velocity;
+    vec3 omega = worldInvInertia() * angularMomentum;
+    orientation = normalize(orientation + (0.5f * h) * (quat(0.0f, omega.x, omega.y, omega.z) * orientation));
+
+    // every mode is an oscillator q'' + 2 zeta omega q' + omega^2 q = 0, implicit Euler
+    float zeta = dampingRatio * dampFactor;
+    for (int j = 0; j < modes(); j++) {
+        float lambda = kFactor * eigenvalues[j];
+        float c = 2.0f * zeta * std::sqrt(lambda);
+        qDot[j] = (qDot[j] - h * lambda * q[j]) / (1.0f + h * c + h * h * lambda);
+        q[j] += h * qDot[j];
+    }
+
+    reconstruct(points);
+    if (projectContacts(points))
+        reconstruct(points);
+}
+
+void ModalReduction::reconstruct(ParticleSystem& points) {
+    int n = particles;
+    mat3 R = mat3_cast(orientation);
+    vec3 omega = worldInvInertia() * angularMomentum;
+    points.parallel([&](int begin, int end) {
+        for (int i = begin; i < end; i++) {
+            offset[i] = restOffset[i];
+            offsetVelocity[i] = vec3(0.0f);
+        }
+        for (int j = 0; j < modes(); j++) {
+            const vec3* shape = &shapes[j * n];
+            for (int i = begin; i < end; i++) {
+                offset[i] += q[j] * shape[i];
+                offsetVelocity[i] += qDot[j] * shape[i];
+            }
+        }
+        for (int i = begin; i < end; i++) {
+            vec3 r = R * offset[i];
+            points.x[i] = center + r;
+            points.v[i] = velocity + cross(omega, r) + R * offsetVelocity[i];
+            points.P[i] = points.mass(i) * points.v[i];
+        }
+    });
+}
+
+bool ModalReduction::projectContacts(ParticleSystem& points) {
+    int n = particles;
+    copy(points.x.begin(), points.x.end(), xBefore.begin());
+    copy(points.v.begin(), points.v.end(), vBefore.begin());
+    checkStairCollision(points);
+
+    // the corrections as impulses and displacements of the rigid and modal parts
+    mat3 R = mat3_cast(orientation);
+    mat3 Rt = transpose(R);
+    vec3 dx(0.0f), dv(0.0f), dL(0.0f), dTheta(0.0f);
+    bool touched = false;
+    for (int i = 0; i < n; i++) {
+        vec3 deltaX = points.x[i] - xBefore[i], deltaV = points.v[i] - vBefore[i];
+        if (deltaX == vec3(0.0f) && deltaV == vec3(0.0f))
+            continue;
+        touched = true;
+        float m = masses[i];
+        vec3 r = xBefore[i] - center;
+        dx += m * deltaX;
+        dv += m * deltaV;
+        dTheta += cross(r, m * deltaX);
+        dL += cross(r, m * deltaV);
+        vec3 bodyX = Rt * deltaX, bodyV = Rt * deltaV;
+        for (int j = 0; j < modes(); j++) {
+            q[j] += m * dot(shapes[j * n + i], bodyX);
+            qDot[j] += m * dot(shapes[j * n + i], bodyV);
+        }
+    }
+    if (!touched)
+        return false;
+
+    center += dx / totalMass;
+    velocity += dv / totalMass;
+    angularMomentum += dL;
+    vec3 rotation = worldInvInertia() * dTheta;
+    float angle = length(rotation);
+    if (angle > 0.0f)
+        orientation = normalize(angleAxis(angle, rotation / angle) * orientation);
+    return true;
+}
@@ -0,0 +1,81 @@
+#ifndef MODAL_REDUCTION_H
+#define MODAL_REDUCTION_H
+
+#include <vector>
+#include <string>
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+#include "ParticleSystem.h"
+
+/**
+* Reduced order deformation: rigid motion plus the lowest vibration modes of
+* the rest stiffness. The modes solve K phi = lambda M phi for the stiffness
+* K = -df/dx of whichever force model is attached, found by subspace
+* iteration with a shifted sparse LDL^T factorization and with the rigid
+* motions projected out. They are mass normalised (phi^T M phi = 1), so each
+* mode is an independent damped oscillator that advances in O(1); a step
+* costs O(k) for the modes plus O(k N) to rebuild the particles.
+*
+* The eigen-solve is the expensive part, so its result is cached in a file
+* named after a hash of the rest positions, masses, stiffness and mode count.
+*
+* The modes live in the body frame; the rigid motion is integrated with the
+* rest inertia and the stair contacts are projected back onto the rigid and
+* modal velocities and positions. The masses are those at reduction time.
+*/
+class ModalReduction {
+public:
+    // damping ratio of every mode at dampFactor 1
+    float dampingRatio;
+    // scales the stiffness (the mode frequencies) and the damping
+    float kFactor;
+    float dampFactor;
+    // the modes of the last reduce came from the cache
+    bool cached;
+
+    ModalReduction();
+    /**
+    * Finds the lowest non rigid modes of the force Jacobian dfdx at the
+    * current positions of points, or loads them from cacheDirectory, where
+    * they are saved after a solve. False if the eigen-solve failed.
+    */
+    bool reduce(const ParticleSystem& points, const BlockSparseMatrix& dfdx, int modes, const std::string& cacheDirectory);
+    /** Number of modes */
+    int modes() const;
+    /** Eigenvalue lambda = omega^2 of mode j at kFactor 1 */
+    float eigenvalue(int j) const;
+    /** Sets the rest shape and masses from points and starts at rest there */
+    void reset(const ParticleSystem& points);
+    /** Advances the reduced state from t to t + h and rebuilds the particles */
+    void advanceState(ParticleSystem& points, float h);
+
+private:
+    int particles;
+    // eigenvalues and mode shapes, mode j of particle i is shapes[j * particles + i]
+    std::vector<float> eigenvalues;
+    std::vector<glm::vec3> shapes;
+    // rest offsets from the centre of mass, masses and rest inertia
+    ParticleSystem::Vec3Array restOffset;
+    std::vector<float> masses;
+    float totalMass;
+    glm::mat3 invInertia;
+    // rigid state and modal coordinates
+    glm::vec3 center, velocity, angularMomentum;
+    glm::quat orientation;
+    std::vector<float> q, qDot;
+    // body frame offsets and modal velocities of the particles, state before the contacts
+    ParticleSystem::Vec3Array offset, offsetVelocity, xBefore, vBefore;
+
+    bool solve(const ParticleSystem& points, const BlockSparseMatrix& dfdx, int modes);
+    bool load(const std::string& path, unsigned long long key, int n, int modes);
+    bool save(const std::string& path, unsigned long long key) const;
+    static unsigned long long hash(const ParticleSystem& points, const BlockSparseMatrix& dfdx, int modes);
+    /** World inverse inertia for the current orientation */
+    glm::mat3 worldInvInertia() const;
+    /** Sets the positions, velocities and momenta of points from the reduced state */
+    void reconstruct(ParticleSystem& points);
+    /** Moves the stair contact corrections of the particles into the reduced state */
+    bool projectContacts(ParticleSystem& points);
+};
+
+#endif
@@ -0,0 +1,368 @@
+#include "ParticleSystem.h"
+#include <algorithm>
+#include <cmath>
+
+using namespace glm;
+
+ParticleSystem::ParticleSystem() {
+}
+
+ParticleSystem::~ParticleSystem() {
+}
+
+int ParticleSystem::size() const {
+    return (int)x.size();
+}
+
+void ParticleSystem::add(const vec3& position, float mass) {
+    x.push_back(position);
+    v.push_back(vec3(0, 0, 0));
+    P.push_back(vec3(0, 0, 0));
+    invM.push_back(1.0f / mass);
+    pinned.push_back(0);
+}
+
+void ParticleSystem::clear() {
+    x.clear();
+    v.clear();
+    P.clear();
+    invM.clear();
+    pinned.clear();
+}
+
+float ParticleSystem::mass(int i) const {
+    return 1.0f / invM[i];
+}
+
+void ParticleSystem::setMass(int i, float m) {
+    invM[i] = 1.0f / m;
+    v[i] = P[i] * invM[i];
+}
+
+void ParticleSystem::dydt(float t) {
+    // x_dot = P / m (pinned particles do not move)
+    parallel([this](int begin, int end) {
+        for (int i = begin; i < end; i++)
+            vStage[i] = pinned[i] ? vec3(0.0f) : PStage[i] * invM[i];
+    });
+    // P_dot = f
+    forcing(t, xStage, vStage, fStage);
+    parallel([this](int begin, int end) {
+        for (int i = begin; i < end; i++)
+            if (pinned[i])
+                fStage[i] = vec3(0.0f);
+    });
+}
+
+void ParticleSystem::reserveStages() {
+    int n = size();
+    if ((int)xStage.size() == n)
+        return;
+    xStage.resize(n);
+    vStage.resize(n);
+    PStage.resize(n);
+    fStage.resize(n);
+    xSum.resize(n);
+    PSum.resize(n);
+    rhs.resize(n);
+    dv.resize(n);
+    for (int s = 0; s < 7; s++) {
+        kx[s].resize(n);
+        kP[s].resize(n);
+    }
+    fStageValid = false;
+}
+
+void ParticleSystem::loadStage() {
+    parallel([this](int begin, int end) {
+        for (int i = begin; i < end; i++) {
+            xStage[i] = x[i];
+            PStage[i] = P[i];
+        }
+    });
+}
+
+void ParticleSystem::advanceState(float t, float h) {
+    reserveStages();
+    if (method != fStageMethod) {
+        fStageValid = false;
+        fStageMethod = method;
+        statistics.reset();
+    }
+
+    switch (method) {
+    case IntegrationMethod::EULER:
+        euler(t, h);
+        break;
+    case IntegrationMethod::SYMPLECTIC_EULER:
+        symplecticEuler(t, h);
+        break;
+    case IntegrationMethod::VELOCITY_VERLET:
+        velocityVerlet(t, h);
+        break;
+    case IntegrationMethod::POSITION_VERLET:
+        positionVerlet(t, h);
+        break;
+    case IntegrationMethod::IMPLICIT_EULER:
+        implicitEuler(t, h);
+        break;
+    case IntegrationMethod::DORMAND_PRINCE:
+        dormandPrince(t, h);
+        break;
+    default:
+        rungeKutta4(t, h);
+        break;
+    }
+
+    parallel([this](int begin, int end) {
+        for (int i = begin; i < end; i++)
+            v[i] = P[i] * invM[i];
+    });
+}
+
+void ParticleSystem::euler(float t, float h) {
+    loadStage();
+    dydt(t);
+    parallel([this, h](int begin, int end) {
+        for (int i = begin; i < end; i++) {
+            x[i] += h * vStage[i];
+            P[i] += h * fStage[i];
+        }
+    });
+}
+
+void ParticleSystem::rungeKutta4(float t, float h) {
+    // Butcher tableau of the classic Runge-Kutta 4th order
+    const float c[4] = { 0.0f, h / 2.0f, h / 2.0f, h };
+    const float b[4] = { h / 6.0f, h / 3.0f, h / 3.0f, h / 6.0f };
+
+    loadStage();
+    parallel([this](int begin, int end) {
+        for (int i = begin; i < end; i++) {
+            xSum[i] = x[i];
+            PSum[i] = P[i];
+        }
+    });
+
+    for (int s = 0; s < 4; s++) {
+        dydt(t + c[s]);
+        // accumulate the weighted stage derivative and build the next stage
+        float a = s < 3 ? c[s + 1] : 0.0f;
+        float w = b[s];
+        parallel([this, a, w](int begin, int end) {
+            for (int i = begin; i < end; i++) {
+                xSum[i] += w * vStage[i];
+                PSum[i] += w * fStage[i];
+                xStage[i] = x[i] + a * vStage[i];
+                PStage[i] = P[i] + a * fStage[i];
+            }
+        });
+    }
+
+    parallel([this](int begin, int end) {
+        for (int i = begin; i < end; i++) {
+            x[i] = xSum[i];
+            P[i] = PSum[i];
+        }
+    });
+}
+
+void ParticleSystem::symplecticEuler(float t, float h) {
+    // kick with f(t), then drift with the new momentum
+    loadStage();
+    dydt(t);
+    parallel([this, h](int begin, int end) {
+        for (int i = begin; i < end; i++) {
+            if (pinned[i])
+                continue;
+            P[i] += h * fStage[i];
+            x[i] += h * P[i] * invM[i];
+        }
+    });
+}
+
+void ParticleSystem::velocityVerlet(float t, float h) {
+    // the force at the start of the step is the one evaluated at the end of
+    // the previous step, so only one force evaluation is needed per step
+    if (!fStageValid) {
+        loadStage();
+        dydt(t);
+    }
+    parallel([this, h](int begin, int end) {
+        for (int i = begin; i < end; i++) {
+            if (pinned[i])
+                continue;
+            P[i] += h / 2.0f * fStage[i];
+            x[i] += h * P[i] * invM[i];
+        }
+    });
+    loadStage();
+    dydt(t + h);
+    parallel([this, h](int begin, int end) {
+        for (int i = begin; i < end; i++)
+            P[i] += h / 2.0f * fStage[i];
+    });
+    fStageValid = true;
+}
+
+void ParticleSystem::positionVerlet(float t, float h) {
+    // drift half a step, kick with the midpoint force, drift again
+    parallel([this, h](int begin, int end) {
+        for (int i = begin; i < end; i++) {
+            if (pinned[i])
+                continue;
+            x[i] += h / 2.0f * P[i] * invM[i];
+        }
+    });
+    loadStage();
+    dydt(t + h / 2.0f);
+    parallel([this, h](int begin, int end) {
+        for (int i = begin; i < end; i++) {
+            if (pinned[i])
+                continue;
+            P[i] += h * fStage[i];
+            x[i] += h / 2.0f * P[i] * invM[i];
+        }
+    });
+}
+
+void ParticleSystem::implicitEuler(float t, float h) {
+    // backward Euler linearized once around the current state (Baraff and Witkin)
+    int n = size();
+    loadStage();
+    dydt(t);
+    forceJacobian(t, x, vStage, dfdx, dfdv);
+
+    // A = M - h df/dv - h^2 df/dx
+    // the Jacobian may have been given another pattern of the same size
+    if (!A.samePattern(dfdx))
+        A = dfdx;
+    A.setZero();
+    A.add(dfdx, -h * h);
+    A.add(dfdv, -h);
+    for (int i = 0; i < n; i++)
+        A.addBlock(i, i, glm::mat3(mass(i)));
+
+    // b = h (f + h df/dx v)
+    dfdx.multiply(vStage, rhs);
+    for (int i = 0; i < n; i++) {
+        rhs[i] = h * (fStage[i] + h * rhs[i]);
+        dv[i] = vec3(0.0f);
+    }
+    linearSolver.solve(A, rhs, dv, pinned);
+
+    for (int i = 0; i < n; i++) {
+        if (pinned[i])
+            continue;
+        P[i] += mass(i) * dv[i];
+        x[i] += h * (vStage[i] + dv[i]);
+    }
+}
+
+namespace {
+    // Dormand-Prince 5(4) tableau
+    const float dpC[7] = { 0.0f, 1.0f / 5.0f, 3.0f / 10.0f, 4.0f / 5.0f, 8.0f / 9.0f, 1.0f, 1.0f };
+    const float dpA[7][6] = {
+        { 0.0f },
+        { 1.0f / 5.0f },
+        { 3.0f / 40.0f, 9.0f / 40.0f },
+        { 44.0f / 45.0f, -56.0f / 15.0f, 32.0f / 9.0f },
+        { 19372.0f / 6561.0f, -25360.0f / 2187.0f, 64448.0f / 6561.0f, -212.0f / 729.0f },
+        { 9017.0f / 3168.0f, -355.0f / 33.0f, 46732.0f / 5247.0f, 49.0f / 176.0f, -5103.0f / 18656.0f },
+        { 35.0f / 384.0f, 0.0f, 500.0f / 1113.0f, 125.0f / 192.0f, -2187.0f / 6784.0f, 11.0f / 84.0f }
+    };
+    // difference between the 5th order weights (last row of A) and the embedded 4th order ones
+    const float dpE[7] = { 71.0f / 57600.0f, 0.0f, -71.0f / 16695.0f, 71.0f / 1920.0f,
+                           -17253.0f / 339200.0f, 22.0f / 525.0f, -1.0f / 40.0f };
+}
+
+float ParticleSystem::dormandPrinceStep(float t, float h, bool firstStageValid) {
+    int n = size();
+    if (!firstStageValid) {
+        loadStage();
+        dydt(t);
+        std::swap(kx[0], vStage);
+        std::swap(kP[0], fStage);
+        statistics.forceEvaluations++;
+    }
+
+    // stages 2..7, the 7th is evaluated at the 5th order solution (first same as last)
+    for (int s = 1; s < 7; s++) {
+        parallel([this, s, h](int begin, int end) {
+            for (int i = begin; i < end; i++) {
+                vec3 dx(0.0f), dP(0.0f);
+                for (int j = 0; j < s; j++) {
+                    dx += dpA[s][j] * kx[j][i];
+                    dP += dpA[s][j] * kP[j][i];
+                }
+                xStage[i] = x[i] + h * dx;
+                PStage[i] = P[i] + h * dP;
+            }
+        });
+        dydt(t + dpC[s] * h);
+        std::swap(kx[s], vStage);
+        std::swap(kP[s], fStage);
+        statistics.forceEvaluations++;
+    }
+
+    // root mean square of the error, scaled by the tolerance of every component
+    float error = 0.0f;
+    for (int i = 0; i < n; i++) {
+        vec3 ex(0.0f), eP(0.0f);
+        for (int s = 0; s < 7; s++) {
+            ex += dpE[s] * kx[s][i];
+            eP += dpE[s] * kP[s][i];
+        }
+        vec3 sx = absoluteTolerance + relativeTolerance * max(abs(x[i]), abs(xStage[i]));
+        vec3 sP = absoluteTolerance + relativeTolerance * max(abs(P[i]), abs(PStage[i]));
+        vec3 qx = h * ex / sx, qP = h * eP / sP;
+        error += dot(qx, qx) + dot(qP, qP);
+    }
+    return sqrt(error / (6.0f * std::max(n, 1)));
+}
+
+void ParticleSystem::dormandPrince(float t, float h) {
+    // the floor is relative to the interval: an absolute one is below the
+    // float spacing of t once the simulation has run for a while
+    const float minStep = h * 1e-6f;
+    if (adaptiveStep <= 0.0f)
+        adaptiveStep = h;
+
+    // time covered by this call, counted from 0 in double so that the end
+    // is always reached whatever the size of t and of the accepted steps
+    double elapsed = 0.0;
+    bool firstStageValid = false;
+    for (int substeps = 0; elapsed < h; substeps++) {
+        float step = std::min(adaptiveStep, float(h - elapsed));
+        // past the cap the rest of the interval is taken as one step
+        bool last = substeps + 1 >= maxAdaptiveSubsteps;
+        if (last)
+            step = float(h - elapsed);
+        float error = dormandPrinceStep(float(t + elapsed), step, firstStageValid);
+
+        // grow or shrink the step, never by more than a factor of 5
+        float factor = error == 0.0f ? 5.0f : 0.9f * pow(error, -0.2f);
+        factor = std::min(5.0f, std::max(0.2f, factor));
+
+        if (error <= 1.0f || step <= minStep || last) {
+            // accept, xStage / PStage hold the 5th order solution
+            std::swap(x, xStage);
+            std::swap(P, PStage);
+            std::swap(kx[0], kx[6]);
+            std::swap(kP[0], kP[6]);
+            firstStageValid = true;
+            statistics.accept(step);
+            elapsed += step;
+            // a step shortened to land on the frame end says nothing about the next one
+            if (step == adaptiveStep)
+                adaptiveStep *= factor;
+            if (last)
+                break;
+        }
+        else {
+            statistics.rejectedSteps++;
+            adaptiveStep = std::max(step * factor, minStep);
+            firstStageValid = true;
+        }
+    }
+}
@@ -0,0 +1,133 @@
+#ifndef PARTICLE_SYSTEM_H
+#define PARTICLE_SYSTEM_H
+
+#include <vector>
+#include <functional>
+#include <algorithm>
+#include <glm/glm.hpp>
+#include <common/util.h>
+#include <common/threadpool.h>
+#include "Integrator.h"
+#include "SparseMatrix.h"
+
+/**
+* Structure-of-arrays store for the mass points of a deformable object. Every
+* per-particle quantity lives in its own contiguous, cache-line aligned array,
+* so the force, integration and collision stages stream through memory.
+*/
+class ParticleSystem {
+public:
+    template<typename T>
+    using Array = std::vector<T, AlignedAllocator<T> >;
+    typedef Array<glm::vec3> Vec3Array;
+
+    // x: position, v: velocity, P: momentum
+    Vec3Array x, v, P;
+    // invM: inverse mass
+    Array<float> invM;
+    // pinned particles are never advanced by the integrator
+    Array<unsigned char> pinned;
+    // scheme used by advanceState
+    IntegrationMethod method = IntegrationMethod::RUNGE_KUTTA_4;
+    // set the forces f of every particle for the whole system state (x, v)
+    std::function<void(float t, const Vec3Array& x, const Vec3Array& v, Vec3Array& f)> forcing =
+        [](float t, const Vec3Array& x, const Vec3Array& v, Vec3Array& f) {
+        std::fill(f.begin(), f.end(), glm::vec3(0.0f));
+    };
+    // set df / dx and df / dv at state (x, v), used by implicit Euler. The
+    // callee sets the pattern; the diagonal blocks of dfdx must be in it and
+    // the pattern of dfdv must be part of the one of dfdx
+    std::function<void(float t, const Vec3Array& x, const Vec3Array& v,
+                       BlockSparseMatrix& dfdx, BlockSparseMatrix& dfdv)> forceJacobian =
+        [](float t, const Vec3Array& x, const Vec3Array& v,
+           BlockSparseMatrix& dfdx, BlockSparseMatrix& dfdv) {
+        if (dfdx.size() != (int)x.size() || dfdx.col.size() != x.size()) {
+            dfdx.setPattern((int)x.size(), std::vector<std::pair<int, int> >());
+            dfdv.setPattern((int)x.size(), std::vector<std::pair<int, int> >());
+        }
+        dfdx.setZero();
+        dfdv.setZero();
+    };
+    // linear solver of implicit Euler, its statistics tell the cost of the last step
+    ConjugateGradient linearSolver;
+    // error tolerances of Dormand-Prince (relative to the state, absolute)
+    float relativeTolerance = 1e-4f;
+    float absoluteTolerance = 1e-5f;
+    // Dormand-Prince substeps per call, past it the rest of the interval is accepted unchecked
+    static const int maxAdaptiveSubsteps = 1000;
+    // substeps taken by Dormand-Prince
+    StepStatistics statistics;
+    // per-particle loops of large systems are split over this pool if set
+    ThreadPool* threadPool = nullptr;
+    // particles per chunk of the parallel loops
+    static const int parallelGrain = 2048;
+
+    ParticleSystem();
+    ~ParticleSystem();
+    /** Number of particles */
+    int size() const;
+    /** Append a particle at rest */
+    void add(const glm::vec3& position, float mass = 1.0f);
+    /** Remove all particles */
+    void clear();
+    /** Mass of particle i */
+    float mass(int i) const;
+    /** Change the mass of particle i keeping its momentum */
+    void setMass(int i, float m);
+    /**
+    * Advances the whole system from t to t + h using the selected method.
+    * Forces are evaluated for all particles at once, so every stage sees
+    * one consistent system state.
+    */
+    void advanceState(float t, float h);
+    /**
+    * Runs body(begin, end) over chunks of the particles, on the thread pool
+    * if there is one and the system has more than parallelGrain particles.
+    * The pool gets the body by reference, so a closure larger than the
+    * small buffer of std::function is not copied to the heap on every call.
+    */
+    template<typename F>
+    void parallel(const F& body) const {
+        parallel(size(), body);
+    }
+    /** Same for any other per-item loop over 0..count, e.g. over the springs */
+    template<typename F>
+    void parallel(int count, const F& body) const {
+        if (threadPool)
+            threadPool->parallelFor(0, count, parallelGrain, std::cref(body));
+        else
+            body(0, count);
+    }
+
+private:
+    // stage buffers, kept between steps so that stepping does not allocate
+    Vec3Array xStage, vStage, PStage, fStage, xSum, PSum;
+    // velocity Verlet reuses the end-of-step force of the previous step
+    bool fStageValid = false;
+    IntegrationMethod fStageMethod = IntegrationMethod::RUNGE_KUTTA_4;
+    // implicit Euler system (M - h df/dv - h^2 df/dx) dv = h (f + h df/dx v)
+    BlockSparseMatrix dfdx, dfdv, A;
+    Vec3Array rhs, dv;
+    // Dormand-Prince stage derivatives and the step size carried between calls
+    Vec3Array kx[7], kP[7];
+    float adaptiveStep = 0.0f;
+
+    void euler(float t, float h);
+    void rungeKutta4(float t, float h);
+    void symplecticEuler(float t, float h);
+    void velocityVerlet(float t, float h);
+    void positionVerlet(float t, float h);
+    void implicitEuler(float t, float h);
+    void dormandPrince(float t, float h);
+    /** One Dormand-Prince step of size h, returns the scaled error norm */
+    float dormandPrinceStep(float t, float h, bool firstStageValid);
+    /** Loads (x, P) into the stage state */
+    void loadStage();
+
+    /** Evaluates dy / dt at stage state (xStage, PStage) into (vStage, fStage) */
+    void dydt(float t);
+    /** Resizes the stage buffers to the particle count */
+    void reserveStages();
+};
+
+#endif
@@ -2,43 +2,225 @@
 #include <vector>
 #include <functional>
 #include <map>
+#include <algorithm>
 using namespace std;
 using namespace glm;
 
 
-void recalculatePointForces(std::vector<RigidBody> &points, std::vector<std::vector<float>> restingDist, int pointIndex, float dampFactor, float kFactor) {
-    points[pointIndex].forcing = [&, restingDist, pointIndex](float t, const vector<float>& y)->vector<float> {
-        vector<float> f(3, 0.0f);
-        for (int i = 0; i < points.size(); i++)
-        {
-            if (pointIndex == i)
-                continue;
-            vec3 dist = points[pointIndex].x - points[i].x;
-            float power = 100.0f * kFactor * (length(dist) - restingDist[pointIndex][i]);
-            vec3 springForce = normalize(dist) * (-power);
-            vec3 damp = normalize(dist) * dot(points[pointIndex].v, dist) * dampFactor;
-            //vec3 damp = points[pointIndex].v * dampFactor;
-            f[0] += springForce.x - damp.x;
-            f[1] += springForce.y - damp.y;
-            f[2] += springForce.z - damp.z;
-        }
-        //f[0] += 0.5;
-        f[1] -= points[pointIndex].m * gravity;
-        return f;
-    };
+void calculateSpringForces(const SpringNetwork& springs, int first, int last, const ParticleSystem::Vec3Array& x, const ParticleSystem::Vec3Array& v, ParticleSystem::Vec3Array& f, float dampFactor, float kFactor) {
+    float k = 100.0f * kFactor;
+    springs.forEachSpring(first, last, [&](int i, int j, float rest)
+    {
+        vec3 dist = x[i] - x[j];
+        float len = length(dist);
+        vec3 dir = dist / len;
+        // the spring pulls both ends with equal and opposite forces, the
+        // damping of each end acts on its own velocity along the spring
+        vec3 springForce = dir * (-k * (len - rest));
+        f[i] += springForce - dir * dot(v[i], dist) * dampFactor;
+        f[j] -= springForce + dir * dot(v[j], dist) * dampFactor;
+    });
 }
 
-void ffdRecalculatePointForces(vector<RigidBody>& points, vector<vec3> restingDist, int pointIndex, float dampFactor, float kFactor) {
-    points[pointIndex].forcing = [&, restingDist, pointIndex](float t, const vector<float>& y)->vector<float> {
-        vector<float> f(3, 0.0f);
-        vec3 dist = points[pointIndex].x - restingDist[pointIndex];
+void ffdCalculatePointForces(const ParticleSystem& points, const vector<vec3>& restingDist, const ParticleSystem::Vec3Array& x, const ParticleSystem::Vec3Array& v, ParticleSystem::Vec3Array& f, float dampFactor, float kFactor) {
+    for (int pointIndex = 0; pointIndex < points.size(); pointIndex++)
+    {
+        vec3 dist = x[pointIndex] - restingDist[pointIndex];
         float power = 100.0f * kFactor * length(dist);
         vec3 springForce = normalize(dist) * (-power);
-        //vec3 damp = normalize(dist) * dot(points[pointIndex].v, dist) * dampFactor;
-        vec3 damp = points[pointIndex].v * dampFactor;
-        f[0] += springForce.x - damp.x;
-        f[1] += springForce.y - damp.y;
-        f[2] += springForce.z - damp.z;
-        return f;
+        //vec3 damp = normalize(dist) * dot(v[pointIndex], dist) * dampFactor;
+        vec3 damp = v[pointIndex] * dampFactor;
+        f[pointIndex] = springForce - damp;
+    }
+}
+
+void calculatePointForceJacobians(const ParticleSystem& points, const SpringNetwork& springs, const ParticleSystem::Vec3Array& x, const ParticleSystem::Vec3Array& v, BlockSparseMatrix& dfdx, BlockSparseMatrix& dfdv, float dampFactor, float kFactor) {
+    int n = points.size();
+    // rebuilt when the network is, not only when the particle count changes
+    if (dfdx.size() != n || dfdx.patternSource != springs.patternSource) {
+        vector<SpringNetwork::Spring> list;
+        springs.list(list);
+        vector<pair<int, int> > pairs;
+        for (int s = 0; s < list.size(); s++)
+            pairs.push_back(make_pair(list[s].i, list[s].j));
+        dfdx.setPattern(n, pairs, springs.patternSource);
+        dfdv.setPattern(n, vector<pair<int, int> >());
+    }
+    dfdx.setZero();
+    dfdv.setZero();
+
+    float k = 100.0f * kFactor;
+    for (int pointIndex = 0; pointIndex < n; pointIndex++)
+    {
+        mat3 diagonal(0.0f), damp(0.0f);
+        springs.forEachSpringOf(pointIndex, [&](int i, float rest)
+        {
+            vec3 dist = x[pointIndex] - x[i];
+            float len = length(dist);
+            vec3 dir = dist / len;
+            mat3 nn = outerProduct(dir, dir);
+            // the transverse term is dropped under compression to keep the
+            // matrix negative semi-definite, as in Choi and Ko
+            float transverse = std::max(1.0f - rest / len, 0.0f);
+            mat3 stiffness = k * (nn + transverse * (mat3(1.0f) - nn));
+            diagonal -= stiffness;
+            dfdx.addBlock(pointIndex, i, stiffness);
+            // damping is -c n (v . dist) = -c |dist| n n^T v
+            damp -= dampFactor * len * nn;
+        });
+        dfdx.addBlock(pointIndex, pointIndex, diagonal);
+        dfdv.addBlock(pointIndex, pointIndex, damp);
+    }
+}
+
+void ffdCalculatePointForceJacobians(const ParticleSystem& points, BlockSparseMatrix& dfdx, BlockSparseMatrix& dfdv, float dampFactor, float kFactor) {
+    int n = points.size();
+    // a diagonal pattern has exactly one block per row
+    if (dfdx.size() != n || (int)dfdx.col.size() != n) {
+        dfdx.setPattern(n, vector<pair<int, int> >());
+        dfdv.setPattern(n, vector<pair<int, int> >());
+    }
+    // zero-length spring to the rest position and absolute damping
+    for (int pointIndex = 0; pointIndex < n; pointIndex++)
+    {
+        dfdx.blocks[pointIndex] = mat3(-100.0f * kFactor);
+        dfdv.blocks[pointIndex] = mat3(-dampFactor);
+    }
+}
+
+// springs per partition and partition limit when the count is automatic
+static const size_t springsPerPartition = 8192;
+static const int maxPartitions = 64;
+
+/** Runs body(begin, end) over the partitions 0..n, on the pool of points if any */
+template<typename F>
+static void forPartitions(const ParticleSystem& points, int n, const F& body) {
+    if (points.threadPool)
+        points.threadPool->parallelFor(0, n, 1, cref(body));
+    else
+        body(0, n);
+}
+
+SpringForceModel::SpringForceModel() {
+    dampFactor = 1.0f;
+    kFactor = 1.0f;
+    setPartitions(0);
+    setSimdLevel(detectSimdLevel());
+}
+
+void SpringForceModel::setPartitions(int count) {
+    requestedPartitions = count;
+    boundsSprings = (size_t)-1;
+}
+
+void SpringForceModel::updatePartitions() {
+    if (boundsSprings == network.count())
+        return;
+    // the partitions only depend on the network, never on the thread count,
+    // so the sums come out the same however many threads run them
+    boundsSprings = network.count();
+    partitions = requestedPartitions;
+    if (partitions <= 0)
+        partitions = (int)std::min<size_t>(maxPartitions, std::max<size_t>(1, boundsSprings / springsPerPartition));
+    network.split(partitions, bounds);
+    partialForces.resize(partitions - 1);
+    partialSoa.resize(3 * partitions);
+}
+
+void SpringForceModel::setSimdLevel(SimdLevel level) {
+    simd = level;
+    rowsKernel = springRowsKernel(level);
+}
+
+SimdLevel SpringForceModel::simdLevel() const {
+    return simd;
+}
+
+void SpringForceModel::attach(ParticleSystem& points) {
+    SpringForceModel* model = this;
+    const ParticleSystem* system = &points;
+    points.forcing = [model, system](float t, const ParticleSystem::Vec3Array& x, const ParticleSystem::Vec3Array& v, ParticleSystem::Vec3Array& f) {
+        model->forces(*system, x, v, f);
+    };
+    points.forceJacobian = [model, system](float t, const ParticleSystem::Vec3Array& x, const ParticleSystem::Vec3Array& v, BlockSparseMatrix& dfdx, BlockSparseMatrix& dfdv) {
+        model->jacobians(*system, x, v, dfdx, dfdv);
     };
-}
\ No newline at end of file
+}
+
+void SpringForceModel::forces(const ParticleSystem& points, const ParticleSystem::Vec3Array& x, const ParticleSystem::Vec3Array& v, ParticleSystem::Vec3Array& f) {
+    updatePartitions();
+    if (network.packedRestData()) {
+        packedForces(points, x, v, f);
+        return;
+    }
+
+    // every partition scatters into its own buffer, the first one into f
+    forPartitions(points, partitions, [&](int begin, int end) {
+        for (int p = begin; p < end; p++)
+            forcePartition(p, x, v, p == 0 ? f : partialForces[p - 1]);
+    });
+
+    // summed in partition order whichever thread computed them
+    points.parallel([&](int begin, int end) {
+        for (int i = begin; i < end; i++) {
+            vec3 force = f[i];
+            for (int p = 0; p < partitions - 1; p++)
+                force += partialForces[p][i];
+            force.y -= points.mass(i) * gravity;
+            f[i] = force;
+        }
+    });
+}
+
+void SpringForceModel::packedForces(const ParticleSystem& points, const ParticleSystem::Vec3Array& x, const ParticleSystem::Vec3Array& v, ParticleSystem::Vec3Array& f) {
+    int n = points.size();
+    for (int c = 0; c < 6; c++)
+        state[c].resize(n);
+    points.parallel([&](int begin, int end) {
+        for (int i = begin; i < end; i++)
+            for (int c = 0; c < 3; c++) {
+                state[c][i] = x[i][c];
+                state[3 + c][i] = v[i][c];
+            }
+    });
+
+    forPartitions(points, partitions, [&](int begin, int end) {
+        for (int p = begin; p < end; p++)
+            forcePartitionSoa(p);
+    });
+
+    points.parallel([&](int begin, int end) {
+        for (int i = begin; i < end; i++) {
+            vec3 force(0.0f);
+            for (int p = 0; p < partitions; p++)
+                force += vec3(partialSoa[3 * p][i], partialSoa[3 * p + 1][i], partialSoa[3 * p + 2][i]);
+            force.y -= points.mass(i) * gravity;
+            f[i] = force;
+        }
+    });
+}
+
+void SpringForceModel::forcePartitionSoa(int p) {
+    int n = (int)state[0].size();
+    for (int c = 0; c < 3; c++)
+        partialSoa[3 * p + c].assign(n, 0.0f);
+    SpringKernelData data = {
+        state[0].data(), state[1].data(), state[2].data(),
+        state[3].data(), state[4].data(), state[5].data(),
+        partialSoa[3 * p].data(), partialSoa[3 * p + 1].data(), partialSoa[3 * p + 2].data(),
+        n
+    };
+    // most rows of a small graph are shorter than a 16-wide pass, 8 do better there
+    SpringRowsKernel kernel = simd == SimdLevel::AVX512 && n < 128 ? springRowsKernel(SimdLevel::AVX2) : rowsKernel;
+    kernel(network.packedRestData(), network.rowStartData(), bounds[p], bounds[p + 1], data, 100.0f * kFactor, dampFactor);
+}
+
+void SpringForceModel::forcePartition(int p, const ParticleSystem::Vec3Array& x, const ParticleSystem::Vec3Array& v, ParticleSystem::Vec3Array& f) {
+    f.resize(x.size());
+    fill(f.begin(), f.end(), vec3(0.0f));
+    calculateSpringForces(network, bounds[p], bounds[p + 1], x, v, f, dampFactor, kFactor);
+}
+
+void SpringForceModel::jacobians(const ParticleSystem& points, const ParticleSystem::Vec3Array& x, const ParticleSystem::Vec3Array& v, BlockSparseMatrix& dfdx, BlockSparseMatrix& dfdv) const {
+    calculatePointForceJacobians(points, network, x, v, dfdx, dfdv, dampFactor, kFactor);
+}
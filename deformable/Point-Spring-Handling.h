@@ -1,5 +1,7 @@
 #pragma once
-#include "RigidBody.h"
+#include "ParticleSystem.h"
+#include "SpringNetwork.h"
+#include "SpringKernels.h"
 #include <vector>
 #include <functional>
 #include <map>
@@ -9,6 +11,68 @@ using namespace glm;
 
 #define gravity 9.80665f
 
-void recalculatePointForces(std::vector<RigidBody> &points, std::vector<std::vector<float>> restingDist, int pointIndex, float dampFactor, float kFactor);
+/** Adds the forces of springs first..last (ranges of SpringNetwork::split) to f, visiting each spring once */
+void calculateSpringForces(const SpringNetwork& springs, int first, int last, const ParticleSystem::Vec3Array& x, const ParticleSystem::Vec3Array& v, ParticleSystem::Vec3Array& f, float dampFactor, float kFactor);
 
-void ffdRecalculatePointForces(vector<RigidBody>& points, vector<vec3> restingDist, int pointIndex, float dampFactor, float kFactor);
\ No newline at end of file
+void ffdCalculatePointForces(const ParticleSystem& points, const vector<vec3>& restingDist, const ParticleSystem::Vec3Array& x, const ParticleSystem::Vec3Array& v, ParticleSystem::Vec3Array& f, float dampFactor, float kFactor);
+
+void calculatePointForceJacobians(const ParticleSystem& points, const SpringNetwork& springs, const ParticleSystem::Vec3Array& x, const ParticleSystem::Vec3Array& v, BlockSparseMatrix& dfdx, BlockSparseMatrix& dfdv, float dampFactor, float kFactor);
+
+/** The constant Jacobians of the FFD control point forces, which do not depend on the state */
+void ffdCalculatePointForceJacobians(const ParticleSystem& points, BlockSparseMatrix& dfdx, BlockSparseMatrix& dfdv, float dampFactor, float kFactor);
+
+/**
+* Mass-spring force model of an object. It owns the spring network with the
+* rest lengths and the spring and damping constants, and is set up once; the
+* particle system evaluates it by reference through attach, so stepping never
+* copies the rest lengths or rebuilds a closure.
+*
+* Every spring is evaluated once and applied to both ends. The springs are
+* split into partitions that scatter into their own force buffers, summed at
+* the end, so the partitions can run concurrently. The full graph with float
+* rest lengths is evaluated by the vectorized kernels of SpringKernels.h.
+*/
+class SpringForceModel {
+public:
+    SpringNetwork network;
+    float dampFactor;
+    float kFactor;
+
+    SpringForceModel();
+    /**
+    * Number of spring partitions with their own force buffer, 0 picks one per
+    * few thousand springs. The partitions run on the thread pool of the
+    * particle system.
+    */
+    void setPartitions(int count);
+    /** Instruction set of the full graph kernel, detected at construction */
+    void setSimdLevel(SimdLevel level);
+    SimdLevel simdLevel() const;
+    /** Sets the forcing and force Jacobian of points to this model */
+    void attach(ParticleSystem& points);
+    void forces(const ParticleSystem& points, const ParticleSystem::Vec3Array& x, const ParticleSystem::Vec3Array& v, ParticleSystem::Vec3Array& f);
+    void jacobians(const ParticleSystem& points, const ParticleSystem::Vec3Array& x, const ParticleSystem::Vec3Array& v, BlockSparseMatrix& dfdx, BlockSparseMatrix& dfdv) const;
+
+private:
+    int requestedPartitions, partitions;
+    // spring ranges of the partitions, for a network of boundsSprings springs
+    vector<int> bounds;
+    size_t boundsSprings;
+    // force buffers of partitions 1.., partition 0 writes to the output
+    vector<ParticleSystem::Vec3Array> partialForces;
+    SimdLevel simd;
+    SpringRowsKernel rowsKernel;
+    // structure-of-arrays x, y, z, vx, vy, vz for the kernel and the
+    // fx, fy, fz buffers of every partition
+    ParticleSystem::Array<float> state[6];
+    vector<ParticleSystem::Array<float> > partialSoa;
+
+    /** Splits the springs again if the network changed */
+    void updatePartitions();
+    /** Forces of the springs of partition p alone into f */
+    void forcePartition(int p, const ParticleSystem::Vec3Array& x, const ParticleSystem::Vec3Array& v, ParticleSystem::Vec3Array& f);
+    /** Same for the full graph kernel, into the structure-of-arrays buffers of the partition */
+    void forcePartitionSoa(int p);
+    /** Forces of the full graph through the vectorized kernel */
+    void packedForces(const ParticleSystem& points, const ParticleSystem::Vec3Array& x, const ParticleSystem::Vec3Array& v, ParticleSystem::Vec3Array& f);
+};
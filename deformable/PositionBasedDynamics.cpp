@@ -0,0 +1,164 @@
+#include "PositionBasedDynamics.h"
+#include "Point-Spring-Handling.h"
+#include "Collision.h"
+#include <algorithm>
+
+using namespace glm;
+using namespace std;
+
+XpbdSolver::XpbdSolver() {
+    substeps = 1;
+    iterations = 10;
+    kFactor = 1.0f;
+    dampFactor = 1.0f;
+    jacobi = true;
+    relaxation = 1.5f;
+}
+
+void XpbdSolver::setConstraints(const SpringNetwork& springs) {
+    vector<SpringNetwork::Spring> list;
+    springs.list(list);
+    constraints.clear();
+    for (int s = 0; s < list.size(); s++) {
+        Constraint c = { list[s].i, list[s].j, list[s].rest };
+        constraints.push_back(c);
+    }
+
+    // particle to constraint incidence, counted then filled in constraint order
+    int n = springs.size();
+    incidentStart.assign(n + 1, 0);
+    for (int k = 0; k < constraints.size(); k++) {
+        incidentStart[constraints[k].i + 1]++;
+        incidentStart[constraints[k].j + 1]++;
+    }
+    for (int i = 0; i < n; i++)
+        incidentStart[i + 1] += incidentStart[i];
+    incident.resize(incidentStart[n]);
+    vector<int> next(incidentStart.begin(), incidentStart.end() - 1);
+    for (int k = 0; k < constraints.size(); k++) {
+        incident[next[constraints[k].i]++] = k;
+        incident[next[constraints[k].j]++] = k;
+    }
+}
+
+void XpbdSolver::advanceState(ParticleSystem& points, float h) {
+    int n = points.size();
+    xPrev.resize(n);
+    xNext.resize(n);
+    lambda.resize(constraints.size());
+    correction.resize(constraints.size());
+    float sh = h / substeps;
+
+    for (int s = 0; s < substeps; s++) {
+        // predict with the external force (gravity)
+        points.parallel([&](int begin, int end) {
+            for (int i = begin; i < end; i++) {
+                xPrev[i] = points.x[i];
+                if (points.pinned[i])
+                    continue;
+                points.v[i].y -= gravity * sh;
+                points.x[i] += sh * points.v[i];
+            }
+        });
+
+        if (jacobi)
+            solveConstraintsJacobi(points, sh);
+        else
+            solveConstraints(points, sh);
+
+        // velocities follow from the corrected positions
+        points.parallel([&](int begin, int end) {
+            for (int i = begin; i < end; i++) {
+                points.v[i] = (points.x[i] - xPrev[i]) / sh;
+                points.P[i] = points.mass(i) * points.v[i];
+            }
+        });
+    }
+}
+
+float XpbdSolver::constraintStep(const ParticleSystem& points, int k, float alpha, float h, bool split, vec3& n) const {
+    const Constraint& c = constraints[k];
+    float wi = points.pinned[c.i] ? 0.0f : points.invM[c.i];
+    float wj = points.pinned[c.j] ? 0.0f : points.invM[c.j];
+    if (split) {
+        wi *= float(incidentStart[c.i + 1] - incidentStart[c.i]);
+        wj *= float(incidentStart[c.j + 1] - incidentStart[c.j]);
+    }
+    if (wi + wj == 0.0f)
+        return 0.0f;
+
+    vec3 dist = points.x[c.i] - points.x[c.j];
+    float len = length(dist);
+    if (len == 0.0f)
+        return 0.0f;
+    n = dist / len;
+    float C = len - c.rest;
+    float alphaTilde = alpha / (h * h);
+
+    // constraint damping, beta matches the |dist| scaled damping of the springs
+    float gamma = alpha * dampFactor * c.rest / h;
+    float velocity = dot(n, (points.x[c.i] - xPrev[c.i]) - (points.x[c.j] - xPrev[c.j]));
+
+    return (-C - alphaTilde * lambda[k] - gamma * velocity)
+        / ((1.0f + gamma) * (wi + wj) + alphaTilde);
+}
+
+void XpbdSolver::solveConstraints(ParticleSystem& points, float h) {
+    // same stiffness as the force based springs
+    float alpha = 1.0f / (100.0f * kFactor);
+    fill(lambda.begin(), lambda.end(), 0.0f);
+
+    for (int it = 0; it < iterations; it++) {
+        for (int k = 0; k < constraints.size(); k++) {
+            const Constraint& c = constraints[k];
+            vec3 n;
+            float dLambda = constraintStep(points, k, alpha, h, false, n);
+            if (dLambda == 0.0f)
+                continue;
+            lambda[k] += dLambda;
+            if (!points.pinned[c.i])
+                points.x[c.i] += points.invM[c.i] * dLambda * n;
+            if (!points.pinned[c.j])
+                points.x[c.j] -= points.invM[c.j] * dLambda * n;
+        }
+
+        // stair contacts, C(x) >= 0 with zero compliance
+        for (int i = 0; i < points.size(); i++)
+            if (!points.pinned[i])
+                projectStairContact(points.x[i]);
+    }
+}
+
+void XpbdSolver::solveConstraintsJacobi(ParticleSystem& points, float h) {
+    float alpha = 1.0f / (100.0f * kFactor);
+    fill(lambda.begin(), lambda.end(), 0.0f);
+
+    for (int it = 0; it < iterations; it++) {
+        // every constraint against the positions of the previous iteration
+        points.parallel((int)constraints.size(), [&](int begin, int end) {
+            for (int k = begin; k < end; k++) {
+                vec3 n(0.0f);
+                float dLambda = constraintStep(points, k, alpha, h, true, n);
+                lambda[k] += dLambda;
+                correction[k] = dLambda * n;
+            }
+        });
+
+        // gather the corrections into the back buffer, then the contacts
+        points.parallel([&](int begin, int end) {
+            for (int i = begin; i < end; i++) {
+                xNext[i] = points.x[i];
+                if (points.pinned[i])
+                    continue;
+                vec3 sum(0.0f);
+                for (int e = incidentStart[i]; e < incidentStart[i + 1]; e++) {
+                    int k = incident[e];
+                    sum += constraints[k].i == i ? correction[k] : -correction[k];
+                }
+                xNext[i] += relaxation * points.invM[i] * sum;
+                projectStairContact(xNext[i]);
+            }
+        });
+        points.x.swap(xNext);
+    }
+}
@@ -0,0 +1,62 @@
+#ifndef POSITION_BASED_DYNAMICS_H
+#define POSITION_BASED_DYNAMICS_H
+
+#include <vector>
+#include "ParticleSystem.h"
+#include "SpringNetwork.h"
+
+/**
+* Extended position based dynamics (Macklin et al. 2016). The springs become
+* distance constraints with compliance 1 / k, so the stiffness does not depend
+* on the step size and the solver stays stable for any step. Stair contacts
+* are projected as inequality constraints inside the same iterations.
+*
+* By default the iterations are Jacobi style: every constraint reads the
+* positions of the previous iteration, the corrections are gathered per
+* particle in a fixed order and written to a second buffer that is then
+* swapped in. The mass of a particle is split evenly between its constraints
+* (Tonge et al. 2012), which keeps the summed corrections bounded without
+* changing the stiffness of compliant constraints. The result does not depend on the constraint order or on how
+* the loops are split between threads. Gauss-Seidel, which converges faster
+* but updates the positions in place, is kept as an option.
+*/
+class XpbdSolver {
+public:
+    struct Constraint {
+        int i, j;
+        float rest;
+    };
+
+    std::vector<Constraint> constraints;
+    // substeps per advanceState and constraint iterations per substep
+    int substeps;
+    int iterations;
+    // spring constant and damping the compliance is derived from
+    float kFactor;
+    float dampFactor;
+    // order independent iterations, false for in place Gauss-Seidel
+    bool jacobi;
+    // over-relaxation of the Jacobi corrections, 1 to 2
+    float relaxation;
+
+    XpbdSolver();
+    /** One distance constraint for every spring of the network */
+    void setConstraints(const SpringNetwork& springs);
+    /** Advances the particles from t to t + h */
+    void advanceState(ParticleSystem& points, float h);
+
+private:
+    ParticleSystem::Vec3Array xPrev, xNext;
+    std::vector<float> lambda;
+    // Jacobi: correction of every constraint, applied +/- to its ends
+    std::vector<glm::vec3> correction;
+    // constraints of particle i are incident[incidentStart[i]..incidentStart[i + 1]), ascending
+    std::vector<int> incidentStart, incident;
+
+    void solveConstraints(ParticleSystem& points, float h);
+    void solveConstraintsJacobi(ParticleSystem& points, float h);
+    /** dLambda of constraint k at the current positions, 0 if it cannot move; split for the Jacobi masses */
+    float constraintStep(const ParticleSystem& points, int k, float alpha, float h, bool split, glm::vec3& n) const;
+};
+
+#endif
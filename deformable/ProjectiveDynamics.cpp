@@ -0,0 +1,154 @@
+#include "ProjectiveDynamics.h"
+#include "Point-Spring-Handling.h"
+#include <algorithm>
+
+using namespace glm;
+using namespace std;
+
+// pinned particles get a mass that no spring can move
+static const float pinnedMass = 1e8f;
+
+ProjectiveDynamicsSolver::ProjectiveDynamicsSolver() {
+    iterations = 10;
+    kFactor = 1.0f;
+    dampFactor = 1.0f;
+    factoredK = 0.0f;
+    factoredStep = 0.0f;
+}
+
+void ProjectiveDynamicsSolver::setConstraints(const SpringNetwork& springs) {
+    vector<SpringNetwork::Spring> list;
+    springs.list(list);
+    constraints.clear();
+    for (int s = 0; s < list.size(); s++) {
+        Constraint c = { list[s].i, list[s].j, list[s].rest };
+        constraints.push_back(c);
+    }
+    colStart.clear();
+    factoredInvMass.clear();
+}
+
+void ProjectiveDynamicsSolver::buildPattern(int n) {
+    vector<vector<int> > rows(n);
+    for (int i = 0; i < n; i++)
+        rows[i].push_back(i);
+    for (int k = 0; k < constraints.size(); k++) {
+        rows[constraints[k].i].push_back(constraints[k].j);
+        rows[constraints[k].j].push_back(constraints[k].i);
+    }
+
+    colStart.assign(1, 0);
+    row.clear();
+    diagonal.resize(n);
+    for (int i = 0; i < n; i++) {
+        sort(rows[i].begin(), rows[i].end());
+        rows[i].erase(unique(rows[i].begin(), rows[i].end()), rows[i].end());
+        row.insert(row.end(), rows[i].begin(), rows[i].end());
+        colStart.push_back((int)row.size());
+    }
+    for (int i = 0; i < n; i++)
+        diagonal[i] = entry(i, i);
+    values.resize(row.size());
+    factorization.analyze(n, colStart, row);
+}
+
+int ProjectiveDynamicsSolver::entry(int r, int c) const {
+    return (int)(lower_bound(row.begin() + colStart[c], row.begin() + colStart[c + 1], r) - row.begin());
+}
+
+void ProjectiveDynamicsSolver::prefactor(const ParticleSystem& points, float h) {
+    int n = points.size();
+    if (colStart.size() != n + 1)
+        buildPattern(n);
+
+    // same stiffness as the force based springs
+    float w = 100.0f * kFactor;
+    factoredInvMass.resize(n);
+    fill(values.begin(), values.end(), 0.0f);
+    for (int i = 0; i < n; i++) {
+        factoredInvMass[i] = points.pinned[i] ? 0.0f : points.invM[i];
+        float m = points.pinned[i] ? pinnedMass : points.mass(i);
+        values[diagonal[i]] += m / (h * h);
+    }
+    for (int k = 0; k < constraints.size(); k++) {
+        int i = constraints[k].i, j = constraints[k].j;
+        values[diagonal[i]] += w;
+        values[diagonal[j]] += w;
+        values[entry(i, j)] -= w;
+        values[entry(j, i)] -= w;
+    }
+    factorization.factorize(values);
+    factoredK = kFactor;
+    factoredStep = h;
+}
+
+bool ProjectiveDynamicsSolver::needsRefactor(const ParticleSystem& points, float h) const {
+    if (factoredInvMass.size() != points.size() || factoredK != kFactor || factoredStep != h)
+        return true;
+    for (int i = 0; i < points.size(); i++)
+        if (factoredInvMass[i] != (points.pinned[i] ? 0.0f : points.invM[i]))
+            return true;
+    return false;
+}
+
+void ProjectiveDynamicsSolver::advanceState(ParticleSystem& points, float h) {
+    int n = points.size();
+    if (needsRefactor(points, h))
+        prefactor(points, h);
+    s.resize(n);
+    p.resize(constraints.size());
+    for (int c = 0; c < 3; c++)
+        rhs[c].resize(n);
+
+    // inertial target x + h v + h^2 M^-1 f_ext, also the initial guess
+    for (int i = 0; i < n; i++) {
+        s[i] = points.x[i];
+        if (points.pinned[i])
+            continue;
+        s[i] += h * points.v[i];
+        s[i].y -= h * h * gravity;
+    }
+    x.resize(n);
+    copy(s.begin(), s.end(), x.begin());
+
+    float w = 100.0f * kFactor;
+    for (int it = 0; it < iterations; it++) {
+        // local step: closest point of every spring at its rest length
+        for (int k = 0; k < constraints.size(); k++) {
+            const Constraint& c = constraints[k];
+            vec3 d = x[c.i] - x[c.j];
+            float len = length(d);
+            p[k] = len > 0.0f ? d * (c.rest / len) : vec3(0.0f);
+        }
+
+        // global step: (M / h^2 + sum w S^T S) x = M s / h^2 + sum w S^T p
+        for (int i = 0; i < n; i++) {
+            float m = points.pinned[i] ? pinnedMass : points.mass(i);
+            vec3 b = m / (h * h) * s[i];
+            for (int c = 0; c < 3; c++)
+                rhs[c][i] = b[c];
+        }
+        for (int k = 0; k < constraints.size(); k++) {
+            vec3 b = w * p[k];
+            for (int c = 0; c < 3; c++) {
+                rhs[c][constraints[k].i] += b[c];
+                rhs[c][constraints[k].j] -= b[c];
+            }
+        }
+        for (int c = 0; c < 3; c++) {
+            factorization.solve(rhs[c]);
+            for (int i = 0; i < n; i++)
+                x[i][c] = rhs[c][i];
+        }
+    }
+
+    // velocities follow from the positions, with implicit linear drag
+    float drag = 1.0f / (1.0f + h * dampFactor);
+    for (int i = 0; i < n; i++) {
+        if (points.pinned[i])
+            continue;
+        points.v[i] = drag * (x[i] - points.x[i]) / h;
+        points.x[i] = x[i];
+        points.P[i] = points.mass(i) * points.v[i];
+    }
+}
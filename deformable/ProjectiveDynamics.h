@@ -0,0 +1,58 @@
+#ifndef PROJECTIVE_DYNAMICS_H
+#define PROJECTIVE_DYNAMICS_H
+
+#include <vector>
+#include "ParticleSystem.h"
+#include "SpringNetwork.h"
+#include "SparseMatrix.h"
+
+/**
+* Projective dynamics (Bouaziz et al. 2014). Every spring projects its current
+* length onto the rest length (local step) and one linear solve with the
+* constant matrix M / h^2 + sum w S^T S joins the projections (global step).
+* The matrix only depends on the masses, the spring constant and the step, so
+* it is factored once and every iteration is a back substitution; it is
+* refactored when one of them changes.
+*/
+class ProjectiveDynamicsSolver {
+public:
+    struct Constraint {
+        int i, j;
+        float rest;
+    };
+
+    std::vector<Constraint> constraints;
+    // local / global iterations per advanceState
+    int iterations;
+    // spring constant the weights are derived from, linear velocity drag
+    float kFactor;
+    float dampFactor;
+
+    ProjectiveDynamicsSolver();
+    /** One spring constraint for every spring of the network */
+    void setConstraints(const SpringNetwork& springs);
+    /** Factors the system matrix for the current masses, kFactor and step h */
+    void prefactor(const ParticleSystem& points, float h);
+    /** Advances the particles from t to t + h, refactoring only if needed */
+    void advanceState(ParticleSystem& points, float h);
+
+private:
+    SparseLDLT factorization;
+    // compressed column pattern of the system matrix and its values
+    std::vector<int> colStart, row, diagonal;
+    std::vector<float> values;
+    // masses (0 for pinned particles), kFactor and step of the factorization
+    std::vector<float> factoredInvMass;
+    float factoredK, factoredStep;
+    // inertial target, projections and per coordinate right hand sides
+    ParticleSystem::Vec3Array s, p, x;
+    std::vector<double> rhs[3];
+
+    /** Builds the pattern of the system matrix, position of every pair in it */
+    void buildPattern(int n);
+    /** Index of entry (r, c) in values */
+    int entry(int r, int c) const;
+    bool needsRefactor(const ParticleSystem& points, float h) const;
+};
+
+#endif
@@ -1,7 +1,5 @@
 #include "RigidBody.h"
-#include <vector>
 #include <functional>
-#include <map>
 
 using namespace glm;
 
@@ -13,8 +11,8 @@ RigidBody::RigidBody() {
 RigidBody::~RigidBody() {
 }
 
-std::vector<float> RigidBody::getY() {
-    std::vector<float> state(STATES);
+RigidBody::StateVector RigidBody::getY() {
+    StateVector state;
     int k = 0;
 
     state[k++] = x.x;
@@ -28,7 +26,7 @@ std::vector<float> RigidBody::getY() {
     return state;
 }
 
-void RigidBody::setY(const std::vector<float>& y) {
+void RigidBody::setY(const StateVector& y) {
     int k = 0;
     x.x = y[k++];
     x.y = y[k++];
@@ -42,75 +40,101 @@ void RigidBody::setY(const std::vector<float>& y) {
     v = P / m;
 }
 
-std::vector<float> RigidBody::dydt(float t, const std::vector<float>& y) {
-    // store initial state and override state
-    std::vector<float> y0 = getY();
-    setY(y);
-
-    std::vector<float> yDot(STATES);
+RigidBody::StateVector RigidBody::dydt(float t, const StateVector& y) {
+    // the velocity is taken from y, so the body itself is never overridden
+    StateVector yDot;
     int k = 0;
 
     //x_dot = u
-    yDot[k++] = v.x;
-    yDot[k++] = v.y;
-    yDot[k++] = v.z;
+    yDot[k++] = y[3] / m;
+    yDot[k++] = y[4] / m;
+    yDot[k++] = y[5] / m;
 
-    auto f = forcing(t, y);
+    vec3 f = forcing(t, y);
     //P_dot = f
-    yDot[k++] = f[0];
-    yDot[k++] = f[1];
-    yDot[k++] = f[2];
-
-    // restore initial state
-    setY(y0);
+    yDot[k++] = f.x;
+    yDot[k++] = f.y;
+    yDot[k++] = f.z;
 
     return yDot;
 }
 
-std::vector<float> RigidBody::euler(float t, float h, const std::vector<float>& y0) {
-    std::vector<float> y1(STATES);
-    std::vector<float> dydt0 = dydt(t, y0);
-    for (int i = 0; i < STATES; i++) {
-        y1[i] = y0[i] + h * dydt0[i];
-    }
-    return y1;
+RigidBody::StateVector RigidBody::euler(float t, float h, const StateVector& y0) {
+    auto derivative = [this](float t, const StateVector& y) { return dydt(t, y); };
+    return integrateEuler<STATES>(derivative, t, h, y0);
 }
 
-std::vector<float> RigidBody::rungeKuta4th(float t, float h, const std::vector<float>& y0) {
-    // dydt0 = dydt(x0)
-    std::vector<float> dydt0 = dydt(t, y0);
+RigidBody::StateVector RigidBody::rungeKuta4th(float t, float h, const StateVector& y0) {
+    auto derivative = [this](float t, const StateVector& y) { return dydt(t, y); };
+    return integrateRungeKutta4<STATES>(derivative, t, h, y0);
+}
 
-    // y1 = y0 + h * dydt0 / 2
-    std::vector<float> y1(STATES);
-    for (int i = 0; i < STATES; i++) {
-        y1[i] = y0[i] + h * dydt0[i] / 2.0f;
+RigidBody::StateVector RigidBody::symplecticEuler(float t, float h, const StateVector& y0) {
+    StateVector y1 = y0;
+    vec3 f = forcing(t, y0);
+    y1[3] += h * f.x;
+    y1[4] += h * f.y;
+    y1[5] += h * f.z;
+    for (int i = 0; i < 3; i++) {
+        y1[i] += h * y1[i + 3] / m;
     }
-    std::vector<float> dydt1 = dydt(t + h / 2.0f, y1);
+    return y1;
+}
 
-    // y2 = y0 + h * dydt1 / 2
-    std::vector<float> y2(STATES);
-    for (int i = 0; i < STATES; i++) {
-        y2[i] = y0[i] + h * dydt1[i] / 2.0f;
+RigidBody::StateVector RigidBody::velocityVerlet(float t, float h, const StateVector& y0) {
+    StateVector y1 = y0;
+    // half kick
+    vec3 f = forcing(t, y0);
+    y1[3] += h / 2.0f * f.x;
+    y1[4] += h / 2.0f * f.y;
+    y1[5] += h / 2.0f * f.z;
+    // drift
+    for (int i = 0; i < 3; i++) {
+        y1[i] += h * y1[i + 3] / m;
     }
-    std::vector<float> dydt2 = dydt(t + h / 2.0f, y2);
+    // half kick with the force at the new position
+    f = forcing(t + h, y1);
+    y1[3] += h / 2.0f * f.x;
+    y1[4] += h / 2.0f * f.y;
+    y1[5] += h / 2.0f * f.z;
+    return y1;
+}
 
-    // y2 = y0 + h * dydt1 / 2
-    std::vector<float> y3(STATES);
-    for (int i = 0; i < STATES; i++) {
-        y3[i] = y0[i] + h * dydt2[i];
+RigidBody::StateVector RigidBody::positionVerlet(float t, float h, const StateVector& y0) {
+    StateVector y1 = y0;
+    // half drift
+    for (int i = 0; i < 3; i++) {
+        y1[i] += h / 2.0f * y1[i + 3] / m;
     }
-    std::vector<float> dydt3 = dydt(t + h, y3);
-
-    // combine them to estimate the solution.
-    std::vector<float> y4(STATES);
-    for (int i = 0; i < STATES; i++) {
-        y4[i] = y0[i] + h * (dydt0[i] + 2.0f * dydt1[i]
-                             + 2.0f * dydt2[i] + dydt3[i]) / 6.0f;
+    // kick with the force at the midpoint
+    vec3 f = forcing(t + h / 2.0f, y1);
+    y1[3] += h * f.x;
+    y1[4] += h * f.y;
+    y1[5] += h * f.z;
+    // half drift
+    for (int i = 0; i < 3; i++) {
+        y1[i] += h / 2.0f * y1[i + 3] / m;
     }
-    return y4;
+    return y1;
 }
 
 void RigidBody::advanceState(float t, float h) {
-    //setY(euler(t, h, getY()));
-    setY(rungeKuta4th(t, h, getY()));
-}
\ No newline at end of file
+    switch (method) {
+    case IntegrationMethod::EULER:
+        setY(euler(t, h, getY()));
+        break;
+    case IntegrationMethod::SYMPLECTIC_EULER:
+        setY(symplecticEuler(t, h, getY()));
+        break;
+    case IntegrationMethod::VELOCITY_VERLET:
+        setY(velocityVerlet(t, h, getY()));
+        break;
+    case IntegrationMethod::POSITION_VERLET:
+        setY(positionVerlet(t, h, getY()));
+        break;
+    default:
+        // implicit Euler needs a force Jacobian, a single body uses RK4 instead
+        setY(rungeKuta4th(t, h, getY()));
+        break;
+    }
+}
@@ -1,39 +1,47 @@
 #ifndef RIGID_BODY_H
 #define RIGID_BODY_H
 
-#include <vector>
 #include <functional>
 #include <glm/glm.hpp>
 #include <glm/gtc/quaternion.hpp>
 #include <glm/gtx/quaternion.hpp>
+#include "Integrator.h"
 
 class RigidBody {
 public:
     static const int STATES = 6;
+    typedef State<STATES> StateVector;
     // m: mass
     float m;
+    // scheme used by advanceState
+    IntegrationMethod method = IntegrationMethod::RUNGE_KUTTA_4;
     // x: position, v: velocity, P: momentum
     glm::vec3 x, v, P;
-    // set the forces
-    std::function<std::vector<float>(float t, const std::vector<float>& y)> forcing =
-        [](float t, const std::vector<float>& y)->std::vector<float> {
-        std::vector<float> f(3, 0.0f);
-        return f;
+    // set the forces, the state the force is evaluated at is y (not x, P)
+    std::function<glm::vec3(float t, const StateVector& y)> forcing =
+        [](float t, const StateVector& y)->glm::vec3 {
+        return glm::vec3(0.0f);
     };
 
     RigidBody();
     ~RigidBody();
     /** Get state vector y */
-    std::vector<float> getY();
+    StateVector getY();
     /** Get state vector y */
-    void setY(const std::vector<float>& y);
+    void setY(const StateVector& y);
     /** Get state derivative vector dy / dt */
-    std::vector<float> dydt(float t, const std::vector<float>& y);
+    StateVector dydt(float t, const StateVector& y);
     /** Euler method for advancing the state y(t + h) = y(t) + h dy(t) / dt */
-    std::vector<float> euler(float t, float h, const std::vector<float>& y0);
+    StateVector euler(float t, float h, const StateVector& y0);
     /** Runge-Kutta 4th order for advancing the state (error/step ~ O(h^5) */
-    std::vector<float> rungeKuta4th(float t, float h, const std::vector<float>& y0);
-    /** Advances the state from t to t + h using Euler or RunkeKutta */
+    StateVector rungeKuta4th(float t, float h, const StateVector& y0);
+    /** Symplectic Euler: P(t + h) = P(t) + h f(t), x(t + h) = x(t) + h P(t + h) / m */
+    StateVector symplecticEuler(float t, float h, const StateVector& y0);
+    /** Velocity Verlet (kick-drift-kick), second order */
+    StateVector velocityVerlet(float t, float h, const StateVector& y0);
+    /** Position Verlet (drift-kick-drift), second order */
+    StateVector positionVerlet(float t, float h, const StateVector& y0);
+    /** Advances the state from t to t + h using the selected method */
     void advanceState(float t, float h);
 };
 
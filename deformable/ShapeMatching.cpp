@@ -0,0 +1,162 @@
+#include "ShapeMatching.h"
+#include "SpatialHash.h"
+#include "Point-Spring-Handling.h"
+#include <cmath>
+
+using namespace glm;
+using namespace std;
+
+void extractRotation(const mat3& A, quat& q, int maxIterations) {
+    for (int it = 0; it < maxIterations; it++) {
+        mat3 R = mat3_cast(q);
+        vec3 omega = cross(R[0], A[0]) + cross(R[1], A[1]) + cross(R[2], A[2]);
+        omega *= 1.0f / (std::fabs(dot(R[0], A[0]) + dot(R[1], A[1]) + dot(R[2], A[2])) + 1e-9f);
+        float w = length(omega);
+        // below float resolution the angle steps only add noise
+        if (w < 1e-6f)
+            break;
+        q = normalize(angleAxis(w, omega / w) * q);
+    }
+}
+
+ShapeMatchingSolver::ShapeMatchingSolver() {
+    stiffness = 0.2f;
+    beta = 0.0f;
+    dampFactor = 1.0f;
+}
+
+void ShapeMatchingSolver::setRestShape(const ParticleSystem& points, float clusterRadius) {
+    int n = points.size();
+    rest = points.x;
+    xPrev.resize(n);
+
+    clusterStart.assign(1, 0);
+    members.clear();
+    if (clusterRadius <= 0.0f) {
+        for (int i = 0; i < n; i++)
+            members.push_back(i);
+        clusterStart.push_back(n);
+    }
+    else {
+        // a particle that is not within half a radius of a cluster centre
+        // starts a new cluster, so every particle is well inside one
+        SpatialHash grid;
+        grid.build(rest, clusterRadius);
+        vector<unsigned char> covered(n, 0);
+        for (int i = 0; i < n; i++) {
+            if (covered[i])
+                continue;
+            covered[i] = 1;
+            members.push_back(i);
+            grid.forEachNear(rest, i, clusterRadius, false, [&](int j) {
+                members.push_back(j);
+                if (length(rest[j] - rest[i]) < 0.5f * clusterRadius)
+                    covered[j] = 1;
+            });
+            clusterStart.push_back((int)members.size());
+        }
+    }
+
+    // the transpose: clusters of every particle, in cluster order
+    particleStart.assign(n + 1, 0);
+    for (int k = 0; k < members.size(); k++)
+        particleStart[members[k] + 1]++;
+    for (int i = 0; i < n; i++)
+        particleStart[i + 1] += particleStart[i];
+    particleClusters.resize(members.size());
+    vector<int> next(particleStart.begin(), particleStart.end() - 1);
+    for (int c = 0; c < clusters(); c++)
+        for (int k = clusterStart[c]; k < clusterStart[c + 1]; k++)
+            particleClusters[next[members[k]]++] = c;
+
+    rotation.assign(clusters(), quat(1.0f, 0.0f, 0.0f, 0.0f));
+    transform.assign(clusters(), mat3(1.0f));
+    center.resize(clusters());
+    restCenter.resize(clusters());
+}
+
+int ShapeMatchingSolver::clusters() const {
+    return (int)clusterStart.size() - 1;
+}
+
+void ShapeMatchingSolver::advanceState(ParticleSystem& points, float h) {
+    int n = points.size();
+    xPrev.resize(n);
+
+    // predict with the external force (gravity)
+    points.parallel([&](int begin, int end) {
+        for (int i = begin; i < end; i++) {
+            xPrev[i] = points.x[i];
+            if (points.pinned[i])
+                continue;
+            points.v[i].y -= gravity * h;
+            points.x[i] += h * points.v[i];
+        }
+    });
+
+    points.parallel(clusters(), [&](int begin, int end) {
+        for (int c = begin; c < end; c++)
+            matchCluster(points, c);
+    });
+
+    // pull towards the mean goal of the clusters, velocities from the positions
+    float drag = 1.0f / (1.0f + h * dampFactor);
+    points.parallel([&](int begin, int end) {
+        for (int i = begin; i < end; i++) {
+            if (points.pinned[i])
+                continue;
+            vec3 target(0.0f);
+            for (int k = particleStart[i]; k < particleStart[i + 1]; k++) {
+                int c = particleClusters[k];
+                target += transform[c] * (rest[i] - restCenter[c]) + center[c];
+            }
+            target /= float(particleStart[i + 1] - particleStart[i]);
+            points.x[i] += stiffness * (target - points.x[i]);
+            points.v[i] = drag * (points.x[i] - xPrev[i]) / h;
+            points.P[i] = points.mass(i) * points.v[i];
+        }
+    });
+}
+
+void ShapeMatchingSolver::matchCluster(const ParticleSystem& points, int c) {
+    int first = clusterStart[c], last = clusterStart[c + 1];
+
+    // centres of mass, with the current masses so that mass changes are followed
+    float totalMass = 0.0f;
+    vec3 cm(0.0f), restCm(0.0f);
+    for (int k = first; k < last; k++) {
+        int i = members[k];
+        float m = points.mass(i);
+        totalMass += m;
+        cm += m * points.x[i];
+        restCm += m * rest[i];
+    }
+    cm /= totalMass;
+    restCm /= totalMass;
+    center[c] = cm;
+    restCenter[c] = restCm;
+
+    // A_pq = sum m p q^T and, for the linear blend, A_qq = sum m q q^T
+    mat3 Apq(0.0f), Aqq(0.0f);
+    for (int k = first; k < last; k++) {
+        int i = members[k];
+        float m = points.mass(i);
+        vec3 p = points.x[i] - cm, q = rest[i] - restCm;
+        Apq += m * outerProduct(p, q);
+        if (beta > 0.0f)
+            Aqq += m * outerProduct(q, q);
+    }
+
+    // rotational part of A_pq, iterated from last step's rotation
+    extractRotation(Apq, rotation[c]);
+    mat3 R = mat3_cast(rotation[c]);
+
+    transform[c] = R;
+    if (beta > 0.0f && determinant(Aqq) > 1e-12f) {
+        // best linear fit with its volume normalised away
+        mat3 A = Apq * inverse(Aqq);
+        float volume = determinant(A);
+        if (volume > 0.0f)
+            transform[c] = beta * (A / std::cbrt(volume)) + (1.0f - beta) * R;
+    }
+}
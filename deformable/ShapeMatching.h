@@ -0,0 +1,63 @@
+#ifndef SHAPE_MATCHING_H
+#define SHAPE_MATCHING_H
+
+#include <vector>
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+#include "ParticleSystem.h"
+
+/**
+* Replaces q by the rotation closest to A, iterating from q (Mueller et al.
+* 2016, "A robust method to extract the rotational part of deformations").
+* Warm started from the last step's rotation it converges in a few iterations.
+*/
+void extractRotation(const glm::mat3& A, glm::quat& q, int maxIterations = 20);
+
+/**
+* Meshless shape matching (Mueller et al. 2005). Every step the rest shape is
+* fitted to the particles with the rotation of the polar decomposition of
+* their covariance, and each particle is pulled a fraction stiffness of the
+* way to its fitted goal. The goals never overshoot, so the method is stable
+* for any step, and one step costs O(N) plus a 3x3 rotation per cluster.
+*
+* With a cluster radius the object is covered by overlapping spherical
+* clusters that are matched on their own; a particle goes to the mean of the
+* goals of its clusters, which lets large objects bend locally.
+*/
+class ShapeMatchingSolver {
+public:
+    // fraction of the distance to the goal covered per step, 0 to 1
+    float stiffness;
+    // blend of the best linear transform into the rotation, 0 keeps the rest shape
+    float beta;
+    // linear velocity drag
+    float dampFactor;
+
+    ShapeMatchingSolver();
+    /**
+    * Takes the current positions as the rest shape. With radius > 0 the
+    * particles are split into clusters of that radius, else they form one.
+    */
+    void setRestShape(const ParticleSystem& points, float clusterRadius = 0.0f);
+    /** Number of clusters */
+    int clusters() const;
+    /** Advances the particles from t to t + h */
+    void advanceState(ParticleSystem& points, float h);
+
+private:
+    // members of cluster c are members[clusterStart[c]..clusterStart[c + 1])
+    std::vector<int> clusterStart, members;
+    // clusters of particle i are particleClusters[particleStart[i]..particleStart[i + 1])
+    std::vector<int> particleStart, particleClusters;
+    ParticleSystem::Vec3Array rest, xPrev;
+    // per cluster fit: rotation (kept to warm start the next step), goal
+    // transform and the current and rest centres of mass
+    std::vector<glm::quat> rotation;
+    std::vector<glm::mat3> transform;
+    ParticleSystem::Vec3Array center, restCenter;
+
+    /** Fits cluster c to the current positions */
+    void matchCluster(const ParticleSystem& points, int c);
+};
+
+#endif
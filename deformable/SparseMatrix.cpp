@@ -0,0 +1,306 @@
+#include "SparseMatrix.h"
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cmath>
+
+using namespace glm;
+using namespace std;
+
+BlockSparseMatrix::BlockSparseMatrix() {
+    patternSource = 0;
+}
+
+int BlockSparseMatrix::size() const {
+    return rowStart.empty() ? 0 : (int)rowStart.size() - 1;
+}
+
+void BlockSparseMatrix::setPattern(int n, const vector<pair<int, int> >& pairs, unsigned source) {
+    vector<vector<int> > columns(n);
+    for (int i = 0; i < n; i++)
+        columns[i].push_back(i);
+    for (int k = 0; k < pairs.size(); k++) {
+        columns[pairs[k].first].push_back(pairs[k].second);
+        columns[pairs[k].second].push_back(pairs[k].first);
+    }
+
+    rowStart.assign(1, 0);
+    col.clear();
+    for (int i = 0; i < n; i++) {
+        sort(columns[i].begin(), columns[i].end());
+        columns[i].erase(unique(columns[i].begin(), columns[i].end()), columns[i].end());
+        col.insert(col.end(), columns[i].begin(), columns[i].end());
+        rowStart.push_back((int)col.size());
+    }
+    blocks.assign(col.size(), mat3(0.0f));
+    patternSource = source;
+}
+
+bool BlockSparseMatrix::samePattern(const BlockSparseMatrix& other) const {
+    return rowStart == other.rowStart && col == other.col;
+}
+
+unsigned BlockSparseMatrix::newPatternSource() {
+    static std::atomic<unsigned> last(0);
+    return ++last;
+}
+
+void BlockSparseMatrix::setZero() {
+    fill(blocks.begin(), blocks.end(), mat3(0.0f));
+}
+
+int BlockSparseMatrix::blockIndex(int row, int column) const {
+    vector<int>::const_iterator begin = col.begin() + rowStart[row];
+    vector<int>::const_iterator end = col.begin() + rowStart[row + 1];
+    vector<int>::const_iterator it = lower_bound(begin, end, column);
+    if (it == end || *it != column)
+        return -1;
+    return (int)(it - col.begin());
+}
+
+void BlockSparseMatrix::addBlock(int row, int column, const mat3& b) {
+    int k = blockIndex(row, column);
+    assert(k >= 0);
+    blocks[k] += b;
+}
+
+void BlockSparseMatrix::add(const BlockSparseMatrix& other, float s) {
+    assert(other.size() == size());
+    for (int i = 0; i < other.size(); i++)
+        for (int k = other.rowStart[i]; k < other.rowStart[i + 1]; k++) {
+            int target = blockIndex(i, other.col[k]);
+            assert(target >= 0);
+            blocks[target] += s * other.blocks[k];
+        }
+}
+
+void BlockSparseMatrix::multiply(const BlockVector& x, BlockVector& y) const {
+    for (int i = 0; i < size(); i++) {
+        vec3 sum(0.0f);
+        for (int k = rowStart[i]; k < rowStart[i + 1]; k++)
+            sum += blocks[k] * x[col[k]];
+        y[i] = sum;
+    }
+}
+
+ConjugateGradient::ConjugateGradient() {
+    maxIterations = 100;
+    tolerance = 1e-4f;
+    iterations = 0;
+    residual = 0.0f;
+}
+
+void ConjugateGradient::solve(const BlockSparseMatrix& A, const BlockVector& b, BlockVector& x,
+                              const vector<unsigned char, AlignedAllocator<unsigned char> >& filter) {
+    int n = A.size();
+    r.resize(n);
+    z.resize(n);
+    p.resize(n);
+    q.resize(n);
+    invDiagonal.resize(n);
+
+    // block-Jacobi preconditioner
+    for (int i = 0; i < n; i++) {
+        int d = A.blockIndex(i, i);
+        invDiagonal[i] = filter[i] ? mat3(0.0f) : inverse(A.blocks[d]);
+    }
+
+    float bNorm = 0.0f;
+    for (int i = 0; i < n; i++)
+        bNorm += dot(b[i], b[i]);
+    bNorm = sqrt(bNorm);
+
+    // r = b - A x
+    A.multiply(x, q);
+    float rz = 0.0f;
+    for (int i = 0; i < n; i++) {
+        if (filter[i])
+            x[i] = vec3(0.0f);
+        r[i] = filter[i] ? vec3(0.0f) : b[i] - q[i];
+        z[i] = invDiagonal[i] * r[i];
+        p[i] = z[i];
+        rz += dot(r[i], z[i]);
+    }
+
+    iterations = 0;
+    residual = 0.0f;
+    if (bNorm == 0.0f)
+        return;
+
+    for (iterations = 0; iterations < maxIterations; iterations++) {
+        float rNorm = 0.0f;
+        for (int i = 0; i < n; i++)
+            rNorm += dot(r[i], r[i]);
+        residual = sqrt(rNorm) / bNorm;
+        if (residual < tolerance)
+            break;
+
+        A.multiply(p, q);
+        float pq = 0.0f;
+        for (int i = 0; i < n; i++) {
+            if (filter[i])
+                q[i] = vec3(0.0f);
+            pq += dot(p[i], q[i]);
+        }
+        if (pq <= 0.0f)
+            break;
+
+        float alpha = rz / pq;
+        float rzNew = 0.0f;
+        for (int i = 0; i < n; i++) {
+            x[i] += alpha * p[i];
+            r[i] -= alpha * q[i];
+            z[i] = invDiagonal[i] * r[i];
+            rzNew += dot(r[i], z[i]);
+        }
+
+        float beta = rzNew / rz;
+        rz = rzNew;
+        for (int i = 0; i < n; i++)
+            p[i] = z[i] + beta * p[i];
+    }
+}
+
+SparseLDLT::SparseLDLT() {
+    n = 0;
+}
+
+void SparseLDLT::analyze(int size, const vector<int>& colStart, const vector<int>& row) {
+    n = size;
+
+    // reverse Cuthill-McKee: breadth first from a low degree node, neighbours by degree
+    perm.clear();
+    vector<unsigned char> visited(n, 0);
+    vector<int> neighbours;
+    for (int start = 0; start < n; start++) {
+        int best = -1;
+        for (int i = 0; i < n; i++)
+            if (!visited[i] && (best < 0 || colStart[i + 1] - colStart[i] < colStart[best + 1] - colStart[best]))
+                best = i;
+        if (best < 0)
+            break;
+        size_t head = perm.size();
+        perm.push_back(best);
+        visited[best] = 1;
+        while (head < perm.size()) {
+            int i = perm[head++];
+            neighbours.clear();
+            for (int p = colStart[i]; p < colStart[i + 1]; p++)
+                if (!visited[row[p]]) {
+                    visited[row[p]] = 1;
+                    neighbours.push_back(row[p]);
+                }
+            sort(neighbours.begin(), neighbours.end(), [&](int a, int b) {
+                return colStart[a + 1] - colStart[a] < colStart[b + 1] - colStart[b];
+            });
+            perm.insert(perm.end(), neighbours.begin(), neighbours.end());
+        }
+    }
+    reverse(perm.begin(), perm.end());
+    permInverse.resize(n);
+    for (int i = 0; i < n; i++)
+        permInverse[perm[i]] = i;
+
+    // permuted pattern, remembering where every value comes from
+    Ap.assign(1, 0);
+    Ai.clear();
+    valueIndex.clear();
+    for (int k = 0; k < n; k++) {
+        int old = perm[k];
+        for (int p = colStart[old]; p < colStart[old + 1]; p++) {
+            Ai.push_back(permInverse[row[p]]);
+            valueIndex.push_back(p);
+        }
+        Ap.push_back((int)Ai.size());
+    }
+    Ax.resize(Ai.size());
+
+    // elimination tree and column counts of L
+    parent.assign(n, -1);
+    lnz.assign(n, 0);
+    flag.assign(n, -1);
+    for (int k = 0; k < n; k++) {
+        flag[k] = k;
+        for (int p = Ap[k]; p < Ap[k + 1]; p++) {
+            for (int i = Ai[p]; i < k && flag[i] != k; i = parent[i]) {
+                if (parent[i] == -1)
+                    parent[i] = k;
+                lnz[i]++;
+                flag[i] = k;
+            }
+        }
+    }
+    Lp.assign(n + 1, 0);
+    for (int k = 0; k < n; k++)
+        Lp[k + 1] = Lp[k] + lnz[k];
+    Li.resize(Lp[n]);
+    Lx.resize(Lp[n]);
+    D.resize(n);
+    y.assign(n, 0.0);
+    pattern.resize(n);
+    work.resize(n);
+}
+
+bool SparseLDLT::factorize(const vector<float>& values) {
+    for (int p = 0; p < Ax.size(); p++)
+        Ax[p] = values[valueIndex[p]];
+
+    for (int k = 0; k < n; k++) {
+        // scatter the upper part of column k and find the pattern of row k of L
+        y[k] = 0.0;
+        int top = n;
+        flag[k] = k;
+        lnz[k] = 0;
+        for (int p = Ap[k]; p < Ap[k + 1]; p++) {
+            int i = Ai[p];
+            if (i > k)
+                continue;
+            y[i] += Ax[p];
+            int len = 0;
+            for (; flag[i] != k; i = parent[i]) {
+                pattern[len++] = i;
+                flag[i] = k;
+            }
+            while (len > 0)
+                pattern[--top] = pattern[--len];
+        }
+
+        // sparse triangular solve for row k
+        D[k] = y[k];
+        y[k] = 0.0;
+        for (; top < n; top++) {
+            int i = pattern[top];
+            double yi = y[i];
+            y[i] = 0.0;
+            int p2 = Lp[i] + lnz[i];
+            for (int p = Lp[i]; p < p2; p++)
+                y[Li[p]] -= Lx[p] * yi;
+            double lki = yi / D[i];
+            D[k] -= lki * yi;
+            Li[p2] = k;
+            Lx[p2] = lki;
+            lnz[i]++;
+        }
+        if (D[k] == 0.0)
+            return false;
+    }
+    return true;
+}
+
+void SparseLDLT::solve(vector<double>& b) const {
+    for (int i = 0; i < n; i++)
+        work[i] = b[perm[i]];
+    // L y = b
+    for (int j = 0; j < n; j++)
+        for (int p = Lp[j]; p < Lp[j + 1]; p++)
+            work[Li[p]] -= Lx[p] * work[j];
+    // D z = y
+    for (int j = 0; j < n; j++)
+        work[j] /= D[j];
+    // L^T x = z
+    for (int j = n - 1; j >= 0; j--)
+        for (int p = Lp[j]; p < Lp[j + 1]; p++)
+            work[j] -= Lx[p] * work[Li[p]];
+    for (int i = 0; i < n; i++)
+        b[perm[i]] = work[i];
+}
@@ -0,0 +1,111 @@
+#ifndef SPARSE_MATRIX_H
+#define SPARSE_MATRIX_H
+
+#include <vector>
+#include <utility>
+#include <glm/glm.hpp>
+#include <common/util.h>
+
+// one glm::vec3 per particle, same layout as ParticleSystem::Vec3Array
+typedef std::vector<glm::vec3, AlignedAllocator<glm::vec3> > BlockVector;
+
+/**
+* Square sparse matrix of 3x3 blocks in compressed sparse row layout. The
+* sparsity pattern is fixed once by setPattern, afterwards only the block
+* values are rewritten, so reassembling it every step does not allocate.
+*/
+class BlockSparseMatrix {
+public:
+    // rowStart[i]..rowStart[i + 1] index the blocks of block row i
+    std::vector<int> rowStart;
+    // column of every block, sorted inside a row
+    std::vector<int> col;
+    std::vector<glm::mat3> blocks;
+    // what the pattern was built from, as given to setPattern; copies keep it
+    unsigned patternSource;
+
+    BlockSparseMatrix();
+    /** Number of block rows */
+    int size() const;
+    /**
+    * Sets the pattern to the diagonal plus every (i, j) and (j, i) of the
+    * given pairs. A producer that keeps a pattern between steps passes its
+    * own source and rebuilds when patternSource differs, so a matrix left
+    * with another pattern of the same size is never written through.
+    */
+    void setPattern(int n, const std::vector<std::pair<int, int> >& pairs, unsigned source = 0);
+    /** True if the pattern is the same as the one of other */
+    bool samePattern(const BlockSparseMatrix& other) const;
+    /** A source no other call has returned, never 0 */
+    static unsigned newPatternSource();
+    /** Zeroes every block keeping the pattern */
+    void setZero();
+    /** Index of block (row, column) in blocks, -1 if it is not in the pattern */
+    int blockIndex(int row, int column) const;
+    /** Adds b to block (row, column), which must be in the pattern (asserted) */
+    void addBlock(int row, int column, const glm::mat3& b);
+    /** this += s * other, the pattern of other must be a subset of this one */
+    void add(const BlockSparseMatrix& other, float s);
+    /** y = this * x */
+    void multiply(const BlockVector& x, BlockVector& y) const;
+};
+
+/**
+* Block-Jacobi preconditioned conjugate gradient for symmetric positive
+* definite block systems. Rows flagged in the filter are held at zero (the
+* constraint filter of Baraff and Witkin), which is how pinned particles are
+* handled. The work vectors are kept between solves.
+*/
+class ConjugateGradient {
+public:
+    int maxIterations;
+    // relative residual |r| / |b| at which the solve stops
+    float tolerance;
+    // statistics of the last solve
+    int iterations;
+    float residual;
+
+    ConjugateGradient();
+    /** Solves A x = b, x holds the initial guess on entry */
+    void solve(const BlockSparseMatrix& A, const BlockVector& b, BlockVector& x,
+               const std::vector<unsigned char, AlignedAllocator<unsigned char> >& filter);
+
+private:
+    BlockVector r, z, p, q;
+    std::vector<glm::mat3> invDiagonal;
+};
+
+/**
+* Sparse LDL^T factorization of a symmetric matrix (up-looking, after Davis'
+* LDL), with a reverse Cuthill-McKee ordering to keep the fill down. analyze
+* works on the pattern only, so a matrix whose values change but whose pattern
+* does not is refactored without allocating. The factor is kept in double:
+* stiff springs make the pivots differences of large numbers.
+*/
+class SparseLDLT {
+public:
+    SparseLDLT();
+    /**
+    * Computes the ordering and the pattern of L for a symmetric n x n matrix
+    * given in compressed column form with both triangles present.
+    */
+    void analyze(int n, const std::vector<int>& colStart, const std::vector<int>& row);
+    /** Numeric factorization, values follow the pattern given to analyze. False if singular */
+    bool factorize(const std::vector<float>& values);
+    /** Solves A x = b in place */
+    void solve(std::vector<double>& b) const;
+
+private:
+    int n;
+    // permutation (new index -> old index) and its inverse
+    std::vector<int> perm, permInverse;
+    // permuted matrix pattern in compressed column form and where its values come from
+    std::vector<int> Ap, Ai, valueIndex;
+    std::vector<double> Ax;
+    // L in compressed column form (unit diagonal not stored) and D
+    std::vector<int> Lp, Li, parent, lnz, flag, pattern;
+    std::vector<double> Lx, D, y;
+    mutable std::vector<double> work;
+};
+
+#endif
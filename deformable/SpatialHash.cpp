@@ -0,0 +1,38 @@
+#include "SpatialHash.h"
+
+using namespace glm;
+using namespace std;
+
+SpatialHash::SpatialHash() {
+    invCellSize = 1.0f;
+    buckets = 1;
+    bucketStart.assign(2, 0);
+}
+
+void SpatialHash::build(const ParticleSystem::Vec3Array& x, float cellSize) {
+    int n = (int)x.size();
+    invCellSize = 1.0f / cellSize;
+    // about two buckets per point keeps the collisions rare
+    int wanted = 1;
+    while (wanted < 2 * n)
+        wanted *= 2;
+    if (wanted > buckets)
+        buckets = wanted;
+
+    // counting sort of the points by bucket
+    bucketStart.assign(buckets + 1, 0);
+    cellOfPoint.resize(n);
+    for (int i = 0; i < n; i++) {
+        cellOfPoint[i] = bucket(cellOf(x[i]));
+        bucketStart[cellOfPoint[i] + 1]++;
+    }
+    for (int b = 0; b < buckets; b++)
+        bucketStart[b + 1] += bucketStart[b];
+    entries.resize(n);
+    for (int i = n - 1; i >= 0; i--)
+        entries[--bucketStart[cellOfPoint[i] + 1]] = i;
+    // the decrements left the start of bucket b in bucketStart[b + 1]
+    for (int b = 0; b < buckets; b++)
+        bucketStart[b] = bucketStart[b + 1];
+    bucketStart[buckets] = n;
+}
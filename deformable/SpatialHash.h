@@ -0,0 +1,73 @@
+#ifndef SPATIAL_HASH_H
+#define SPATIAL_HASH_H
+
+#include <vector>
+#include <cmath>
+#include <glm/glm.hpp>
+#include "ParticleSystem.h"
+
+/**
+* Uniform grid over the particles with the cells hashed into a fixed table
+* (Teschner et al. 2003), so the grid needs no bounds and its memory follows
+* the particle count. The points of every hash bucket are stored contiguously
+* after a counting sort; rebuilding for new positions does not allocate once
+* the table has grown to the particle count.
+*
+* Distinct cells can share a bucket, queries therefore test the distance of
+* every candidate.
+*/
+class SpatialHash {
+public:
+    SpatialHash();
+    /** Bins the points x into cells of the given size */
+    void build(const ParticleSystem::Vec3Array& x, float cellSize);
+    /**
+    * Calls f(j) for every point j other than i closer than radius to point i,
+    * radius must not exceed the cell size. With upper set only j > i are
+    * reported, so every pair is seen once.
+    */
+    template<typename F>
+    void forEachNear(const ParticleSystem::Vec3Array& x, int i, float radius, bool upper, F f) const {
+        glm::ivec3 c = cellOf(x[i]);
+        float r2 = radius * radius;
+        // the 27 cells around i, skipping buckets an earlier cell already mapped to
+        int seen[27], cells = 0;
+        for (int dz = -1; dz <= 1; dz++)
+            for (int dy = -1; dy <= 1; dy++)
+                for (int dx = -1; dx <= 1; dx++) {
+                    int b = bucket(c + glm::ivec3(dx, dy, dz));
+                    bool repeated = false;
+                    for (int k = 0; k < cells && !repeated; k++)
+                        repeated = seen[k] == b;
+                    if (repeated)
+                        continue;
+                    seen[cells++] = b;
+                    for (int e = bucketStart[b]; e < bucketStart[b + 1]; e++) {
+                        int j = entries[e];
+                        if (j == i || (upper && j < i))
+                            continue;
+                        glm::vec3 d = x[j] - x[i];
+                        if (glm::dot(d, d) < r2)
+                            f(j);
+                    }
+                }
+    }
+
+private:
+    float invCellSize;
+    // power of two number of buckets
+    int buckets;
+    // points of bucket b are entries[bucketStart[b]..bucketStart[b + 1])
+    std::vector<int> bucketStart, entries, cellOfPoint;
+
+    glm::ivec3 cellOf(const glm::vec3& p) const {
+        return glm::ivec3(int(std::floor(p.x * invCellSize)), int(std::floor(p.y * invCellSize)),
+                          int(std::floor(p.z * invCellSize)));
+    }
+    int bucket(const glm::ivec3& c) const {
+        unsigned h = (unsigned)c.x * 73856093u ^ (unsigned)c.y * 19349663u ^ (unsigned)c.z * 83492791u;
+        return int(h & unsigned(buckets - 1));
+    }
+};
+
+#endif
@@ -0,0 +1,264 @@
+#include "SpringKernels.h"
+#include <cmath>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define SPRING_KERNELS_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+// GCC and Clang compile each kernel for its own instruction set, MSVC
+// accepts the intrinsics anywhere
+#if defined(__GNUC__)
+#define SIMD_TARGET(isa) __attribute__((target(isa)))
+#else
+#define SIMD_TARGET(isa)
+#endif
+
+/** Exact force of spring (i, j), used by the scalar kernel and for row tails */
+static inline void springForce(int i, int j, float rest, const SpringKernelData& d, float k, float c,
+                               float& fix, float& fiy, float& fiz) {
+    float dx = d.x[i] - d.x[j], dy = d.y[i] - d.y[j], dz = d.z[i] - d.z[j];
+    float len = std::sqrt(dx * dx + dy * dy + dz * dz);
+    float s = -k * (len - rest);
+    float ai = (s - c * (d.vx[i] * dx + d.vy[i] * dy + d.vz[i] * dz)) / len;
+    float aj = (s + c * (d.vx[j] * dx + d.vy[j] * dy + d.vz[j] * dz)) / len;
+    fix += ai * dx;
+    fiy += ai * dy;
+    fiz += ai * dz;
+    d.fx[j] -= aj * dx;
+    d.fy[j] -= aj * dy;
+    d.fz[j] -= aj * dz;
+}
+
+static void springRowsScalar(const float* rest, const size_t* rowStart, int first, int last,
+                             const SpringKernelData& d, float k, float c) {
+    for (int i = first; i < last; i++) {
+        const float* r = rest + rowStart[i];
+        float fix = 0.0f, fiy = 0.0f, fiz = 0.0f;
+        for (int j = i + 1; j < d.n; j++)
+            springForce(i, j, r[j - i - 1], d, k, c, fix, fiy, fiz);
+        d.fx[i] += fix;
+        d.fy[i] += fiy;
+        d.fz[i] += fiz;
+    }
+}
+
+#ifdef SPRING_KERNELS_X86
+
+SIMD_TARGET("sse4.2")
+static void springRowsSse(const float* rest, const size_t* rowStart, int first, int last,
+                          const SpringKernelData& d, float k, float c) {
+    const __m128 vk = _mm_set1_ps(k), vc = _mm_set1_ps(c);
+    const __m128 half = _mm_set1_ps(0.5f), threeHalves = _mm_set1_ps(1.5f);
+    for (int i = first; i < last; i++) {
+        const float* r = rest + rowStart[i];
+        __m128 xi = _mm_set1_ps(d.x[i]), yi = _mm_set1_ps(d.y[i]), zi = _mm_set1_ps(d.z[i]);
+        __m128 vxi = _mm_set1_ps(d.vx[i]), vyi = _mm_set1_ps(d.vy[i]), vzi = _mm_set1_ps(d.vz[i]);
+        __m128 fix = _mm_setzero_ps(), fiy = _mm_setzero_ps(), fiz = _mm_setzero_ps();
+        int j = i + 1;
+        for (; j + 4 <= d.n; j += 4) {
+            __m128 dx = _mm_sub_ps(xi, _mm_loadu_ps(d.x + j));
+            __m128 dy = _mm_sub_ps(yi, _mm_loadu_ps(d.y + j));
+            __m128 dz = _mm_sub_ps(zi, _mm_loadu_ps(d.z + j));
+            __m128 d2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+            __m128 inv = _mm_rsqrt_ps(d2);
+            inv = _mm_mul_ps(inv, _mm_sub_ps(threeHalves, _mm_mul_ps(_mm_mul_ps(half, d2), _mm_mul_ps(inv, inv))));
+            __m128 s = _mm_mul_ps(vk, _mm_sub_ps(_mm_loadu_ps(r + (j - i - 1)), _mm_mul_ps(d2, inv)));
+            __m128 di = _mm_add_ps(_mm_add_ps(_mm_mul_ps(vxi, dx), _mm_mul_ps(vyi, dy)), _mm_mul_ps(vzi, dz));
+            __m128 dj = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_loadu_ps(d.vx + j), dx),
+                                              _mm_mul_ps(_mm_loadu_ps(d.vy + j), dy)),
+                                   _mm_mul_ps(_mm_loadu_ps(d.vz + j), dz));
+            __m128 ai = _mm_mul_ps(_mm_sub_ps(s, _mm_mul_ps(vc, di)), inv);
+            __m128 aj = _mm_mul_ps(_mm_add_ps(s, _mm_mul_ps(vc, dj)), inv);
+            fix = _mm_add_ps(fix, _mm_mul_ps(ai, dx));
+            fiy = _mm_add_ps(fiy, _mm_mul_ps(ai, dy));
+            fiz = _mm_add_ps(fiz, _mm_mul_ps(ai, dz));
+            _mm_storeu_ps(d.fx + j, _mm_sub_ps(_mm_loadu_ps(d.fx + j), _mm_mul_ps(aj, dx)));
+            _mm_storeu_ps(d.fy + j, _mm_sub_ps(_mm_loadu_ps(d.fy + j), _mm_mul_ps(aj, dy)));
+            _mm_storeu_ps(d.fz + j, _mm_sub_ps(_mm_loadu_ps(d.fz + j), _mm_mul_ps(aj, dz)));
+        }
+        float sx[4], sy[4], sz[4];
+        _mm_storeu_ps(sx, fix);
+        _mm_storeu_ps(sy, fiy);
+        _mm_storeu_ps(sz, fiz);
+        float tx = (sx[0] + sx[1]) + (sx[2] + sx[3]);
+        float ty = (sy[0] + sy[1]) + (sy[2] + sy[3]);
+        float tz = (sz[0] + sz[1]) + (sz[2] + sz[3]);
+        for (; j < d.n; j++)
+            springForce(i, j, r[j - i - 1], d, k, c, tx, ty, tz);
+        d.fx[i] += tx;
+        d.fy[i] += ty;
+        d.fz[i] += tz;
+    }
+}
+
+SIMD_TARGET("avx2")
+static void springRowsAvx2(const float* rest, const size_t* rowStart, int first, int last,
+                           const SpringKernelData& d, float k, float c) {
+    const __m256 vk = _mm256_set1_ps(k), vc = _mm256_set1_ps(c);
+    const __m256 half = _mm256_set1_ps(0.5f), threeHalves = _mm256_set1_ps(1.5f);
+    for (int i = first; i < last; i++) {
+        const float* r = rest + rowStart[i];
+        __m256 xi = _mm256_set1_ps(d.x[i]), yi = _mm256_set1_ps(d.y[i]), zi = _mm256_set1_ps(d.z[i]);
+        __m256 vxi = _mm256_set1_ps(d.vx[i]), vyi = _mm256_set1_ps(d.vy[i]), vzi = _mm256_set1_ps(d.vz[i]);
+        __m256 fix = _mm256_setzero_ps(), fiy = _mm256_setzero_ps(), fiz = _mm256_setzero_ps();
+        int j = i + 1;
+        for (; j + 8 <= d.n; j += 8) {
+            __m256 dx = _mm256_sub_ps(xi, _mm256_loadu_ps(d.x + j));
+            __m256 dy = _mm256_sub_ps(yi, _mm256_loadu_ps(d.y + j));
+            __m256 dz = _mm256_sub_ps(zi, _mm256_loadu_ps(d.z + j));
+            __m256 d2 = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)), _mm256_mul_ps(dz, dz));
+            __m256 inv = _mm256_rsqrt_ps(d2);
+            inv = _mm256_mul_ps(inv, _mm256_sub_ps(threeHalves, _mm256_mul_ps(_mm256_mul_ps(half, d2), _mm256_mul_ps(inv, inv))));
+            __m256 s = _mm256_mul_ps(vk, _mm256_sub_ps(_mm256_loadu_ps(r + (j - i - 1)), _mm256_mul_ps(d2, inv)));
+            __m256 di = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(vxi, dx), _mm256_mul_ps(vyi, dy)), _mm256_mul_ps(vzi, dz));
+            __m256 dj = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_loadu_ps(d.vx + j), dx),
+                                                    _mm256_mul_ps(_mm256_loadu_ps(d.vy + j), dy)),
+                                      _mm256_mul_ps(_mm256_loadu_ps(d.vz + j), dz));
+            __m256 ai = _mm256_mul_ps(_mm256_sub_ps(s, _mm256_mul_ps(vc, di)), inv);
+            __m256 aj = _mm256_mul_ps(_mm256_add_ps(s, _mm256_mul_ps(vc, dj)), inv);
+            fix = _mm256_add_ps(fix, _mm256_mul_ps(ai, dx));
+            fiy = _mm256_add_ps(fiy, _mm256_mul_ps(ai, dy));
+            fiz = _mm256_add_ps(fiz, _mm256_mul_ps(ai, dz));
+            _mm256_storeu_ps(d.fx + j, _mm256_sub_ps(_mm256_loadu_ps(d.fx + j), _mm256_mul_ps(aj, dx)));
+            _mm256_storeu_ps(d.fy + j, _mm256_sub_ps(_mm256_loadu_ps(d.fy + j), _mm256_mul_ps(aj, dy)));
+            _mm256_storeu_ps(d.fz + j, _mm256_sub_ps(_mm256_loadu_ps(d.fz + j), _mm256_mul_ps(aj, dz)));
+        }
+        float sx[8], sy[8], sz[8];
+        _mm256_storeu_ps(sx, fix);
+        _mm256_storeu_ps(sy, fiy);
+        _mm256_storeu_ps(sz, fiz);
+        float tx = ((sx[0] + sx[1]) + (sx[2] + sx[3])) + ((sx[4] + sx[5]) + (sx[6] + sx[7]));
+        float ty = ((sy[0] + sy[1]) + (sy[2] + sy[3])) + ((sy[4] + sy[5]) + (sy[6] + sy[7]));
+        float tz = ((sz[0] + sz[1]) + (sz[2] + sz[3])) + ((sz[4] + sz[5]) + (sz[6] + sz[7]));
+        for (; j < d.n; j++)
+            springForce(i, j, r[j - i - 1], d, k, c, tx, ty, tz);
+        d.fx[i] += tx;
+        d.fy[i] += ty;
+        d.fz[i] += tz;
+    }
+}
+
+SIMD_TARGET("avx512f")
+static void springRowsAvx512(const float* rest, const size_t* rowStart, int first, int last,
+                             const SpringKernelData& d, float k, float c) {
+    const __m512 vk = _mm512_set1_ps(k), vc = _mm512_set1_ps(c);
+    const __m512 half = _mm512_set1_ps(0.5f), threeHalves = _mm512_set1_ps(1.5f);
+    for (int i = first; i < last; i++) {
+        const float* r = rest + rowStart[i];
+        __m512 xi = _mm512_set1_ps(d.x[i]), yi = _mm512_set1_ps(d.y[i]), zi = _mm512_set1_ps(d.z[i]);
+        __m512 vxi = _mm512_set1_ps(d.vx[i]), vyi = _mm512_set1_ps(d.vy[i]), vzi = _mm512_set1_ps(d.vz[i]);
+        __m512 fix = _mm512_setzero_ps(), fiy = _mm512_setzero_ps(), fiz = _mm512_setzero_ps();
+        int j = i + 1;
+        for (; j + 16 <= d.n; j += 16) {
+            __m512 dx = _mm512_sub_ps(xi, _mm512_loadu_ps(d.x + j));
+            __m512 dy = _mm512_sub_ps(yi, _mm512_loadu_ps(d.y + j));
+            __m512 dz = _mm512_sub_ps(zi, _mm512_loadu_ps(d.z + j));
+            __m512 d2 = _mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(dx, dx), _mm512_mul_ps(dy, dy)), _mm512_mul_ps(dz, dz));
+            __m512 inv = _mm512_rsqrt14_ps(d2);
+            inv = _mm512_mul_ps(inv, _mm512_sub_ps(threeHalves, _mm512_mul_ps(_mm512_mul_ps(half, d2), _mm512_mul_ps(inv, inv))));
+            __m512 s = _mm512_mul_ps(vk, _mm512_sub_ps(_mm512_loadu_ps(r + (j - i - 1)), _mm512_mul_ps(d2, inv)));
+            __m512 di = _mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(vxi, dx), _mm512_mul_ps(vyi, dy)), _mm512_mul_ps(vzi, dz));
+            __m512 dj = _mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(_mm512_loadu_ps(d.vx + j), dx),
+                                                    _mm512_mul_ps(_mm512_loadu_ps(d.vy + j), dy)),
+                                      _mm512_mul_ps(_mm512_loadu_ps(d.vz + j), dz));
+            __m512 ai = _mm512_mul_ps(_mm512_sub_ps(s, _mm512_mul_ps(vc, di)), inv);
+            __m512 aj = _mm512_mul_ps(_mm512_add_ps(s, _mm512_mul_ps(vc, dj)), inv);
+            fix = _mm512_add_ps(fix, _mm512_mul_ps(ai, dx));
+            fiy = _mm512_add_ps(fiy, _mm512_mul_ps(ai, dy));
+            fiz = _mm512_add_ps(fiz, _mm512_mul_ps(ai, dz));
+            _mm512_storeu_ps(d.fx + j, _mm512_sub_ps(_mm512_loadu_ps(d.fx + j), _mm512_mul_ps(aj, dx)));
+            _mm512_storeu_ps(d.fy + j, _mm512_sub_ps(_mm512_loadu_ps(d.fy + j), _mm512_mul_ps(aj, dy)));
+            _mm512_storeu_ps(d.fz + j, _mm512_sub_ps(_mm512_loadu_ps(d.fz + j), _mm512_mul_ps(aj, dz)));
+        }
+        float tx = _mm512_reduce_add_ps(fix);
+        float ty = _mm512_reduce_add_ps(fiy);
+        float tz = _mm512_reduce_add_ps(fiz);
+        for (; j < d.n; j++)
+            springForce(i, j, r[j - i - 1], d, k, c, tx, ty, tz);
+        d.fx[i] += tx;
+        d.fy[i] += ty;
+        d.fz[i] += tz;
+    }
+}
+
+static void cpuid(int leaf, int subleaf, unsigned int regs[4]) {
+#ifdef _MSC_VER
+    int r[4];
+    __cpuidex(r, leaf, subleaf);
+    for (int i = 0; i < 4; i++)
+        regs[i] = (unsigned int)r[i];
+#else
+    __asm__ __volatile__("cpuid" : "=a"(regs[0]), "=b"(regs[1]), "=c"(regs[2]), "=d"(regs[3]) : "a"(leaf), "c"(subleaf));
+#endif
+}
+
+static unsigned long long xgetbv0() {
+#ifdef _MSC_VER
+    return _xgetbv(0);
+#else
+    unsigned int eax, edx;
+    __asm__ __volatile__("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+    return ((unsigned long long)edx << 32) | eax;
+#endif
+}
+
+#endif
+
+SimdLevel detectSimdLevel() {
+#ifdef SPRING_KERNELS_X86
+    unsigned int regs[4];
+    cpuid(0, 0, regs);
+    unsigned int maxLeaf = regs[0];
+    cpuid(1, 0, regs);
+    bool sse42 = (regs[2] >> 20) & 1;
+    bool osxsave = (regs[2] >> 27) & 1;
+    bool avx = (regs[2] >> 28) & 1;
+    if (!sse42)
+        return SimdLevel::SCALAR;
+    // the wide registers must also be saved by the operating system
+    unsigned long long xcr0 = (osxsave && avx) ? xgetbv0() : 0;
+    if (maxLeaf < 7 || (xcr0 & 0x6) != 0x6)
+        return SimdLevel::SSE42;
+    cpuid(7, 0, regs);
+    if (((regs[1] >> 16) & 1) && (xcr0 & 0xe6) == 0xe6)
+        return SimdLevel::AVX512;
+    if ((regs[1] >> 5) & 1)
+        return SimdLevel::AVX2;
+    return SimdLevel::SSE42;
+#else
+    return SimdLevel::SCALAR;
+#endif
+}
+
+SpringRowsKernel springRowsKernel(SimdLevel level) {
+#ifdef SPRING_KERNELS_X86
+    switch (level) {
+    case SimdLevel::SSE42:
+        return springRowsSse;
+    case SimdLevel::AVX2:
+        return springRowsAvx2;
+    case SimdLevel::AVX512:
+        return springRowsAvx512;
+    default:
+        break;
+    }
+#endif
+    return springRowsScalar;
+}
+
+const char* simdLevelName(SimdLevel level) {
+    switch (level) {
+    case SimdLevel::SSE42:
+        return "SSE4.2";
+    case SimdLevel::AVX2:
+        return "AVX2";
+    case SimdLevel::AVX512:
+        return "AVX-512";
+    default:
+        return "scalar";
+    }
+}
@@ -0,0 +1,49 @@
+#ifndef SPRING_KERNELS_H
+#define SPRING_KERNELS_H
+
+#include <cstddef>
+
+/**
+* Vectorized spring force kernels for the full spring graph. They walk rows
+* of the packed rest length table over structure-of-arrays positions and
+* velocities, 4 (SSE4.2), 8 (AVX2) or 16 (AVX-512) springs at a time, using
+* rsqrt with one Newton step instead of a square root and two divisions.
+* The widest instruction set the processor supports is picked at run time.
+*
+* One Newton step brings the rsqrt estimate to about float precision, and
+* the forces of a particle are summed in a different order. Against the
+* scalar kernel, the largest difference of a particle's total force stays
+* below 2e-6 of the largest total force on the bundled models and on random
+* graphs of up to 4000 particles. For a given instruction set the results
+* are reproducible bit for bit.
+*/
+enum class SimdLevel {
+    SCALAR,
+    SSE42,
+    AVX2,
+    AVX512
+};
+
+/** Particle state and force accumulators in structure-of-arrays form */
+struct SpringKernelData {
+    const float *x, *y, *z;
+    const float *vx, *vy, *vz;
+    float *fx, *fy, *fz;
+    int n;
+};
+
+/**
+* Adds the forces of the springs of rows first..last of the packed table to
+* the accumulators, row i holding the rest lengths of pairs (i, i + 1..n - 1)
+* from rest + rowStart[i].
+*/
+typedef void (*SpringRowsKernel)(const float* rest, const size_t* rowStart, int first, int last,
+                                 const SpringKernelData& data, float k, float dampFactor);
+
+/** Widest instruction set supported by the processor and the operating system */
+SimdLevel detectSimdLevel();
+/** Kernel for the given instruction set, level must be supported */
+SpringRowsKernel springRowsKernel(SimdLevel level);
+const char* simdLevelName(SimdLevel level);
+
+#endif
@@ -0,0 +1,237 @@
+#include "SpringNetwork.h"
+#include "SpatialHash.h"
+#include <set>
+#include <map>
+#include <algorithm>
+#include <limits>
+
+using namespace glm;
+using namespace std;
+
+SpringNetwork::SpringNetwork() {
+    allPairs = false;
+    halfPrecision = false;
+    structural = shear = bending = 0;
+    particles = 0;
+    patternSource = 0;
+}
+
+int SpringNetwork::size() const {
+    return particles;
+}
+
+size_t SpringNetwork::count() const {
+    return allPairs ? (size_t)particles * (particles - 1) / 2 : springs.size();
+}
+
+void SpringNetwork::addSpring(const ParticleSystem::Vec3Array& x, int i, int j) {
+    Spring s = { std::min(i, j), std::max(i, j), length(x[i] - x[j]) };
+    springs.push_back(s);
+}
+
+void SpringNetwork::buildAllPairs(const ParticleSystem::Vec3Array& x, bool half) {
+    int n = (int)x.size();
+    patternSource = BlockSparseMatrix::newPatternSource();
+    allPairs = true;
+    halfPrecision = half;
+    particles = n;
+    springs.clear();
+    adjacencyStart.clear();
+    adjacency.clear();
+
+    // row i follows the n - 1, n - 2, .. n - i pairs of the rows above it
+    rowStart.resize(n);
+    for (int i = 0; i < n; i++)
+        rowStart[i] = (size_t)i * (n - 1) - (size_t)i * (i - 1) / 2;
+    size_t pairs = count();
+    packedRest.clear();
+    packedRestHalf.clear();
+    if (halfPrecision)
+        packedRestHalf.resize(pairs);
+    else
+        packedRest.resize(pairs);
+    for (int i = 0; i < n; i++)
+        for (int j = i + 1; j < n; j++) {
+            float rest = length(x[i] - x[j]);
+            if (halfPrecision)
+                packedRestHalf[rowStart[i] + (j - i - 1)] = packHalf1x16(rest);
+            else
+                packedRest[rowStart[i] + (j - i - 1)] = rest;
+        }
+    structural = (int)pairs;
+    shear = bending = 0;
+}
+
+void SpringNetwork::buildFromMesh(const ParticleSystem::Vec3Array& x, const vector<int>& triangles) {
+    int n = (int)x.size();
+    patternSource = BlockSparseMatrix::newPatternSource();
+    allPairs = false;
+    halfPrecision = false;
+    particles = n;
+    springs.clear();
+    packedRest.clear();
+    packedRestHalf.clear();
+    rowStart.clear();
+
+    // structural: the triangle edges, with the corners opposite to every edge
+    map<pair<int, int>, vector<int> > opposite;
+    for (int t = 0; t + 2 < triangles.size(); t += 3)
+        for (int e = 0; e < 3; e++) {
+            int a = triangles[t + e], b = triangles[t + (e + 1) % 3];
+            opposite[make_pair(std::min(a, b), std::max(a, b))].push_back(triangles[t + (e + 2) % 3]);
+        }
+    set<pair<int, int> > connected;
+    vector<vector<int> > neighbours(n);
+    for (map<pair<int, int>, vector<int> >::iterator it = opposite.begin(); it != opposite.end(); ++it) {
+        int a = it->first.first, b = it->first.second;
+        if (a == b || !connected.insert(it->first).second)
+            continue;
+        addSpring(x, a, b);
+        neighbours[a].push_back(b);
+        neighbours[b].push_back(a);
+    }
+    structural = (int)springs.size();
+
+    // shear: across every edge, between the corners of the adjacent triangles
+    for (map<pair<int, int>, vector<int> >::iterator it = opposite.begin(); it != opposite.end(); ++it) {
+        const vector<int>& corners = it->second;
+        for (int k = 0; k < corners.size(); k++)
+            for (int l = k + 1; l < corners.size(); l++) {
+                int a = std::min(corners[k], corners[l]), b = std::max(corners[k], corners[l]);
+                if (a != b && connected.insert(make_pair(a, b)).second)
+                    addSpring(x, a, b);
+            }
+    }
+    shear = (int)springs.size() - structural;
+
+    // bending: everything else two edges apart
+    for (int a = 0; a < n; a++)
+        for (int k = 0; k < neighbours[a].size(); k++) {
+            int m = neighbours[a][k];
+            for (int l = 0; l < neighbours[m].size(); l++) {
+                int b = neighbours[m][l];
+                if (a < b && connected.insert(make_pair(a, b)).second)
+                    addSpring(x, a, b);
+            }
+        }
+    bending = (int)springs.size() - structural - shear;
+
+    buildAdjacency(n);
+}
+
+void SpringNetwork::buildWithinRadius(const ParticleSystem::Vec3Array& x, float radius, int anchors) {
+    int n = (int)x.size();
+    patternSource = BlockSparseMatrix::newPatternSource();
+    allPairs = false;
+    halfPrecision = false;
+    particles = n;
+    springs.clear();
+    packedRest.clear();
+    packedRestHalf.clear();
+    rowStart.clear();
+
+    SpatialHash grid;
+    grid.build(x, radius);
+    for (int i = 0; i < n; i++)
+        grid.forEachNear(x, i, radius, true, [&](int j) {
+            addSpring(x, i, j);
+        });
+    structural = (int)springs.size();
+    shear = 0;
+
+    // anchors by farthest point sampling from particle 0, every particle is
+    // tied to those it has no cutoff spring to already
+    anchors = std::min(anchors, n);
+    vector<float> distance(n, numeric_limits<float>::max());
+    vector<bool> anchor(n, false);
+    for (int a = 0, next = 0; a < anchors; a++) {
+        anchor[next] = true;
+        for (int i = 0; i < n; i++) {
+            vec3 d = x[i] - x[next];
+            if (!anchor[i] && dot(d, d) >= radius * radius)
+                addSpring(x, i, next);
+        }
+        int farthest = next;
+        for (int i = 0; i < n; i++) {
+            distance[i] = std::min(distance[i], length(x[i] - x[next]));
+            if (distance[i] > distance[farthest])
+                farthest = i;
+        }
+        // every particle sits on an anchor already
+        if (distance[farthest] <= 0.0f)
+            break;
+        next = farthest;
+    }
+    bending = (int)springs.size() - structural;
+
+    buildAdjacency(n);
+}
+
+float SpringNetwork::meanEdgeLength(const ParticleSystem::Vec3Array& x, const vector<int>& triangles) {
+    float sum = 0.0f;
+    int edges = 0;
+    for (int t = 0; t + 2 < triangles.size(); t += 3)
+        for (int e = 0; e < 3; e++) {
+            sum += length(x[triangles[t + e]] - x[triangles[t + (e + 1) % 3]]);
+            edges++;
+        }
+    return edges > 0 ? sum / edges : 0.0f;
+}
+
+void SpringNetwork::buildAdjacency(int n) {
+    vector<vector<pair<int, int> > > rows(n);
+    for (int s = 0; s < springs.size(); s++) {
+        rows[springs[s].i].push_back(make_pair(springs[s].j, s));
+        rows[springs[s].j].push_back(make_pair(springs[s].i, s));
+    }
+    adjacencyStart.assign(1, 0);
+    adjacency.clear();
+    for (int i = 0; i < n; i++) {
+        sort(rows[i].begin(), rows[i].end());
+        for (int k = 0; k < rows[i].size(); k++)
+            adjacency.push_back(rows[i][k].second);
+        adjacencyStart.push_back((int)adjacency.size());
+    }
+}
+
+int SpringNetwork::other(int s, int i) const {
+    return springs[s].i == i ? springs[s].j : springs[s].i;
+}
+
+void SpringNetwork::list(vector<Spring>& out) const {
+    if (!allPairs) {
+        out = springs;
+        return;
+    }
+    out.clear();
+    out.reserve(count());
+    for (int i = 0; i < particles; i++)
+        for (int j = i + 1; j < particles; j++) {
+            Spring s = { i, j, pairRest(i, j) };
+            out.push_back(s);
+        }
+}
+
+size_t SpringNetwork::memory() const {
+    return packedRest.size() * sizeof(float) + packedRestHalf.size() * sizeof(uint16)
+        + rowStart.size() * sizeof(rowStart[0]) + springs.size() * sizeof(Spring)
+        + (adjacencyStart.size() + adjacency.size()) * sizeof(int);
+}
+
+void SpringNetwork::split(int parts, vector<int>& bounds) const {
+    bounds.assign(1, 0);
+    if (!allPairs) {
+        for (int p = 1; p <= parts; p++)
+            bounds.push_back((int)((size_t)springs.size() * p / parts));
+        return;
+    }
+    // row i holds n - 1 - i pairs, close a range once it has its share
+    size_t total = count(), done = 0;
+    for (int i = 0; i < particles; i++) {
+        done += particles - 1 - i;
+        if (bounds.size() < parts && done * parts >= total * bounds.size())
+            bounds.push_back(i + 1);
+    }
+    while (bounds.size() <= parts)
+        bounds.push_back(particles);
+}
@@ -0,0 +1,133 @@
+#ifndef SPRING_NETWORK_H
+#define SPRING_NETWORK_H
+
+#include <vector>
+#include <glm/gtc/packing.hpp>
+#include "ParticleSystem.h"
+
+/**
+* The springs of an object with their rest lengths. Either every pair of
+* particles is connected (the original full graph), or the springs follow the
+* triangle mesh or join the particles closer than a cutoff radius; the last
+* two keep the force cost linear in the particle count.
+*
+* The full graph keeps only its rest lengths, packed row by row as the upper
+* triangle of the pair table in one contiguous buffer, optionally as half
+* floats; the pairs themselves are implicit. Mesh and cutoff springs are an
+* edge list with the springs of every particle in compressed sparse row form.
+*/
+class SpringNetwork {
+public:
+    struct Spring {
+        int i, j;
+        float rest;
+    };
+
+    // every pair is connected, only the packed rest lengths are stored
+    bool allPairs;
+    // the packed rest lengths are half floats
+    bool halfPrecision;
+    // mesh springs: structural first, then shear, then bending; cutoff
+    // springs count as structural and their anchor springs as bending
+    std::vector<Spring> springs;
+    int structural, shear, bending;
+    // adjacencyStart[i]..adjacencyStart[i + 1] index the mesh springs of
+    // particle i in adjacency, sorted by the other particle
+    std::vector<int> adjacencyStart, adjacency;
+    // new on every build, the pattern source of the Jacobians of this network
+    unsigned patternSource;
+
+    SpringNetwork();
+    /** Number of particles */
+    int size() const;
+    /** Number of springs */
+    size_t count() const;
+    /** One spring for every pair of particles, at rest at positions x */
+    void buildAllPairs(const ParticleSystem::Vec3Array& x, bool halfPrecision = false);
+    /**
+    * Springs from the triangle connectivity (three indices per triangle):
+    * structural along the edges, shear between the opposite corners of the
+    * two triangles sharing an edge and bending between the remaining
+    * particles two edges apart.
+    */
+    void buildFromMesh(const ParticleSystem::Vec3Array& x, const std::vector<int>& triangles);
+    /**
+    * One spring for every pair of particles closer than radius at positions
+    * x, found with a spatial hash in about linear time. The neighbourhoods
+    * are those of the rest shape, so the springs do not change while the
+    * object deforms.
+    *
+    * Local springs alone let a large object sag and drift out of shape, so
+    * every particle is also tied to anchors particles spread over the object
+    * by farthest point sampling, which adds about anchors * n long springs.
+    */
+    void buildWithinRadius(const ParticleSystem::Vec3Array& x, float radius, int anchors = 0);
+    /** Mean length of the triangle edges, the natural unit of the cutoff radius */
+    static float meanEdgeLength(const ParticleSystem::Vec3Array& x, const std::vector<int>& triangles);
+    /** Every spring with its end points, for setup code that needs a list */
+    void list(std::vector<Spring>& out) const;
+    /** Bytes used by the rest lengths and the connectivity */
+    size_t memory() const;
+    /** Packed float rest lengths of the full graph and the row offsets, null otherwise */
+    const float* packedRestData() const { return allPairs && !halfPrecision ? packedRest.data() : 0; }
+    const size_t* rowStartData() const { return rowStart.data(); }
+    /** The particle at the other end of mesh spring s from particle i */
+    int other(int s, int i) const;
+
+    /** Rest length of pair (i, j), i < j, of the full graph */
+    float pairRest(int i, int j) const {
+        size_t k = rowStart[i] + (j - i - 1);
+        return halfPrecision ? glm::unpackHalf1x16(packedRestHalf[k]) : packedRest[k];
+    }
+
+    /**
+    * Splits the springs into parts ranges of about the same number of springs,
+    * range p is bounds[p]..bounds[p + 1]. The unit is a row of the pair table
+    * for the full graph and a spring for mesh springs.
+    */
+    void split(int parts, std::vector<int>& bounds) const;
+
+    /** Calls f(i, j, rest) once for every spring of range first..last of split, linearly in memory */
+    template<typename F>
+    void forEachSpring(int first, int last, F f) const {
+        if (allPairs) {
+            for (int i = first; i < last; i++)
+                for (int j = i + 1; j < particles; j++)
+                    f(i, j, pairRest(i, j));
+        }
+        else {
+            for (int s = first; s < last; s++)
+                f(springs[s].i, springs[s].j, springs[s].rest);
+        }
+    }
+
+    /** Calls f(j, rest) for every spring between particle i and a particle j, by ascending j */
+    template<typename F>
+    void forEachSpringOf(int i, F f) const {
+        if (allPairs) {
+            for (int j = 0; j < i; j++)
+                f(j, pairRest(j, i));
+            for (int j = i + 1; j < particles; j++)
+                f(j, pairRest(i, j));
+        }
+        else {
+            for (int k = adjacencyStart[i]; k < adjacencyStart[i + 1]; k++) {
+                int s = adjacency[k];
+                f(other(s, i), springs[s].rest);
+            }
+        }
+    }
+
+private:
+    int particles;
+    // upper triangle of the full graph, row i holds the pairs (i, i + 1..n - 1)
+    // from rowStart[i] on
+    std::vector<float> packedRest;
+    std::vector<glm::uint16> packedRestHalf;
+    std::vector<size_t> rowStart;
+
+    void addSpring(const ParticleSystem::Vec3Array& x, int i, int j);
+    void buildAdjacency(int n);
+};
+
+#endif
@@ -0,0 +1,457 @@
+/**
+* Headless benchmarks of the simulation kernels; no window or GL is needed.
+* Run from the deformable directory, which holds the models:
+*
+*     bench [section..]
+*
+* With no argument every section runs. Times are wall-clock means over
+* enough repetitions to take a noticeable fraction of a second, on as many
+* threads as the kernel would use in the demo unless stated otherwise.
+*/
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <chrono>
+#include <random>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <functional>
+#include <new>
+#include <cstdlib>
+#include <glm/glm.hpp>
+#include "ParticleSystem.h"
+#include "SpringNetwork.h"
+#include "SpringKernels.h"
+#include "Point-Spring-Handling.h"
+#include "FreeFormDeformation.h"
+#include "RigidBody.h"
+#include "Collision.h"
+
+using namespace glm;
+using namespace std;
+
+// heap traffic through operator new, which AlignedAllocator goes through too
+static size_t allocations = 0, allocatedBytes = 0;
+
+void* operator new(size_t bytes) {
+    allocations++;
+    allocatedBytes += bytes;
+    void* p = malloc(bytes > 0 ? bytes : 1);
+    if (p == NULL)
+        throw bad_alloc();
+    return p;
+}
+
+void operator delete(void* p) noexcept {
+    free(p);
+}
+
+namespace {
+    /** Mean time of body() in microseconds over reps calls */
+    double timeMicroseconds(int reps, const function<void()>& body) {
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        for (int r = 0; r < reps; r++)
+            body();
+        return chrono::duration<double, micro>(chrono::steady_clock::now() - start).count() / reps;
+    }
+
+    /** The positions and triangles of an .obj file, false if it cannot be read */
+    bool loadModel(const char* path, ParticleSystem::Vec3Array& vertices, vector<int>& triangles) {
+        FILE* file = fopen(path, "r");
+        if (file == NULL) {
+            printf("Cannot open %s, run the benchmark from the deformable directory\n", path);
+            return false;
+        }
+        char line[256];
+        while (fgets(line, sizeof(line), file)) {
+            vec3 v;
+            int a, b, c;
+            if (sscanf(line, "v %f %f %f", &v.x, &v.y, &v.z) == 3)
+                vertices.push_back(v);
+            else if (sscanf(line, "f %d/%*d/%*d %d/%*d/%*d %d/%*d/%*d", &a, &b, &c) == 3) {
+                triangles.push_back(a - 1);
+                triangles.push_back(b - 1);
+                triangles.push_back(c - 1);
+            }
+        }
+        fclose(file);
+        return true;
+    }
+
+    /** n points uniformly in the cube -1..1 */
+    void randomPoints(int n, unsigned seed, ParticleSystem::Vec3Array& points) {
+        mt19937 generator(seed);
+        uniform_real_distribution<float> uniform(-1.0f, 1.0f);
+        points.resize(n);
+        for (int i = 0; i < n; i++)
+            points[i] = vec3(uniform(generator), uniform(generator), uniform(generator));
+    }
+
+    /**
+    * All-pairs spring forces of the teapot, the sphere and random clouds at a
+    * perturbed state: the scalar pairwise kernel against the packed kernel
+    * at every instruction set the machine supports, with the largest
+    * difference of a total force relative to the largest total force.
+    */
+    void benchSprings() {
+        printf("All-pairs spring forces, us per evaluation\n");
+        const char* names[] = { "teapot", "sphere", "random 1000", "random 4000" };
+        for (int c = 0; c < 4; c++) {
+            ParticleSystem points;
+            ParticleSystem::Vec3Array rest;
+            vector<int> triangles;
+            if (c == 0 && !loadModel("models/tea.obj", rest, triangles))
+                continue;
+            if (c == 1 && !loadModel("models/spherev2.obj", rest, triangles))
+                continue;
+            if (c >= 2)
+                randomPoints(c == 2 ? 1000 : 4000, 1, rest);
+            for (int i = 0; i < rest.size(); i++)
+                points.add(rest[i]);
+            int n = points.size();
+            SpringForceModel model;
+            model.network.buildAllPairs(points.x);
+
+            mt19937 generator(2);
+            uniform_real_distribution<float> uniform(-1.0f, 1.0f);
+            ParticleSystem::Vec3Array x = points.x, v(n), reference(n), f(n);
+            for (int i = 0; i < n; i++) {
+                x[i] += 0.05f * vec3(uniform(generator), uniform(generator), uniform(generator));
+                v[i] = vec3(uniform(generator), uniform(generator), uniform(generator));
+            }
+            int reps = std::max(3, 20000000 / (n * n));
+            double pairwise = timeMicroseconds(reps, [&]() {
+                std::fill(reference.begin(), reference.end(), vec3(0.0f));
+                calculateSpringForces(model.network, 0, n, x, v, reference, 1.0f, 1.0f);
+            });
+            for (int i = 0; i < n; i++)
+                reference[i].y -= points.mass(i) * gravity;
+            printf("  %-12s %5d particles  pairwise %9.1f", names[c], n, pairwise);
+
+            double scale = 0.0;
+            for (int i = 0; i < n; i++)
+                scale = std::max(scale, (double)length(reference[i]));
+            for (int level = 0; level <= (int)detectSimdLevel(); level++) {
+                model.setSimdLevel((SimdLevel)level);
+                double packed = timeMicroseconds(reps, [&]() {
+                    model.forces(points, x, v, f);
+                });
+                double error = 0.0;
+                for (int i = 0; i < n; i++)
+                    error = std::max(error, (double)length(f[i] - reference[i]));
+                printf("  %s %9.1f (%.0e)", simdLevelName((SimdLevel)level), packed, error / scale);
+            }
+            printf("\n");
+        }
+    }
+
+    /**
+    * Full FFD products of the teapot padded with random points in its box,
+    * on every instruction set the machine supports, written to 6 triangle
+    * corners per vertex in mesh order; a kernel that differs from the scalar
+    * one prints its largest difference.
+    */
+    void benchFfd() {
+        printf("FFD full deformation, ms per call\n");
+        ParticleSystem::Vec3Array tea;
+        vector<int> triangles;
+        if (!loadModel("models/tea.obj", tea, triangles))
+            return;
+        vec3 lower = tea[0], upper = tea[0];
+        for (int i = 1; i < tea.size(); i++) {
+            lower = glm::min(lower, tea[i]);
+            upper = glm::max(upper, tea[i]);
+        }
+        ThreadPool pool;
+        const int cases[][2] = { { 110, 1 }, { 110, 8 }, { 10000, 3 }, { 10000, 8 }, { 100000, 3 },
+            { 100000, 8 }, { 1000000, 1 }, { 1000000, 3 }, { 1000000, 8 } };
+        for (int c = 0; c < sizeof(cases) / sizeof(cases[0]); c++) {
+            int n = cases[c][0], cells = cases[c][1];
+            mt19937 generator(3);
+            uniform_real_distribution<float> uniform(0.0f, 1.0f);
+            vector<vec3> vertices(tea.begin(), tea.end());
+            while (vertices.size() < n)
+                vertices.push_back(lower + (upper - lower) * vec3(uniform(generator), uniform(generator), uniform(generator)));
+            vertices.resize(n);
+            vector<int> corners(6 * n);
+            for (int i = 0; i < corners.size(); i++)
+                corners[i] = std::min(n - 1, i / 6 + i % 3);
+
+            FfdLattice lattice;
+            lattice.threadPool = &pool;
+            lattice.setLattice(lower, upper, cells, cells, cells);
+            lattice.embed(vertices);
+            lattice.setRenderIndices(corners);
+            vector<vec3> control = lattice.restControlPoints();
+            for (int i = 0; i < control.size(); i++)
+                control[i] += 0.1f * vec3(uniform(generator), uniform(generator), uniform(generator));
+
+            printf("  %7d vertices %d^3", n, cells);
+            vector<vec3> reference, out;
+            int reps = std::max(3, int(2e7 / (double(n) * lattice.controlPoints())));
+            for (int level = 0; level <= (int)detectSimdLevel(); level++) {
+                lattice.setSimdLevel((SimdLevel)level);
+                double ms = timeMicroseconds(reps, [&]() {
+                    lattice.deform(control, out);
+                }) / 1000.0;
+                if (level == 0)
+                    reference = out;
+                float error = 0.0f;
+                for (int i = 0; i < out.size(); i++)
+                    error = std::max(error, length(out[i] - reference[i]));
+                printf("  %s %8.3f", simdLevelName((SimdLevel)level), ms);
+                if (error > 0.0f)
+                    printf(" (%.0e)", error);
+            }
+            printf("\n");
+        }
+    }
+
+    /**
+    * Reference copy of the force path the demo started from, kept to measure
+    * the per-frame heap traffic that SpringForceModel removed: every particle
+    * was a rigid body with a vector<float> state, and every frame rebuilt its
+    * forcing closure around a copy of the whole rest length table.
+    */
+    namespace original {
+        struct Particle {
+            static const int STATES = 6;
+            float m = 1.0f;
+            vec3 x, v, P;
+            function<vector<float>(float t, const vector<float>& y)> forcing;
+
+            vector<float> getY() {
+                vector<float> state(STATES);
+                state[0] = x.x; state[1] = x.y; state[2] = x.z;
+                state[3] = P.x; state[4] = P.y; state[5] = P.z;
+                return state;
+            }
+
+            void setY(const vector<float>& y) {
+                x = vec3(y[0], y[1], y[2]);
+                P = vec3(y[3], y[4], y[5]);
+                v = P / m;
+            }
+
+            vector<float> dydt(float t, const vector<float>& y) {
+                vector<float> y0 = getY();
+                setY(y);
+                vector<float> yDot(STATES);
+                yDot[0] = v.x; yDot[1] = v.y; yDot[2] = v.z;
+                vector<float> f = forcing(t, y);
+                yDot[3] = f[0]; yDot[4] = f[1]; yDot[5] = f[2];
+                setY(y0);
+                return yDot;
+            }
+
+            void advanceState(float t, float h) {
+                vector<float> y0 = getY();
+                vector<float> dydt0 = dydt(t, y0);
+                vector<float> y1(STATES), y2(STATES), y3(STATES), y4(STATES);
+                for (int i = 0; i < STATES; i++)
+                    y1[i] = y0[i] + h * dydt0[i] / 2.0f;
+                vector<float> dydt1 = dydt(t + h / 2.0f, y1);
+                for (int i = 0; i < STATES; i++)
+                    y2[i] = y0[i] + h * dydt1[i] / 2.0f;
+                vector<float> dydt2 = dydt(t + h / 2.0f, y2);
+                for (int i = 0; i < STATES; i++)
+                    y3[i] = y0[i] + h * dydt2[i];
+                vector<float> dydt3 = dydt(t + h, y3);
+                for (int i = 0; i < STATES; i++)
+                    y4[i] = y0[i] + h * (dydt0[i] + 2.0f * dydt1[i] + 2.0f * dydt2[i] + dydt3[i]) / 6.0f;
+                setY(y4);
+            }
+        };
+
+        void recalculatePointForces(vector<Particle>& points, vector<vector<float> > restingDist, int pointIndex, float dampFactor, float kFactor) {
+            points[pointIndex].forcing = [&, restingDist, pointIndex](float t, const vector<float>& y)->vector<float> {
+                vector<float> f(3, 0.0f);
+                for (int i = 0; i < points.size(); i++) {
+                    if (pointIndex == i)
+                        continue;
+                    vec3 dist = points[pointIndex].x - points[i].x;
+                    float power = 100.0f * kFactor * (length(dist) - restingDist[pointIndex][i]);
+                    vec3 springForce = normalize(dist) * (-power);
+                    vec3 damp = normalize(dist) * dot(points[pointIndex].v, dist) * dampFactor;
+                    f[0] += springForce.x - damp.x;
+                    f[1] += springForce.y - damp.y;
+                    f[2] += springForce.z - damp.z;
+                }
+                f[1] -= points[pointIndex].m * gravity;
+                return f;
+            };
+        }
+    }
+
+    /**
+    * Heap allocations per step of a falling rigid body under every explicit
+    * method and of the teapot springs under every method, and per frame of
+    * the spring models in the demo next to the original closure path
+    */
+    void benchAllocations() {
+        printf("Heap allocations per step\n");
+        for (int m = 0; m <= (int)IntegrationMethod::POSITION_VERLET; m++) {
+            RigidBody body;
+            body.method = (IntegrationMethod)m;
+            body.forcing = [](float t, const RigidBody::StateVector& y) {
+                return vec3(0.0f, -gravity, 0.0f);
+            };
+            body.advanceState(0.0f, 0.001f);
+            const int steps = 100000;
+            size_t before = allocations;
+            for (int s = 0; s < steps; s++)
+                body.advanceState(s * 0.001f, 0.001f);
+            printf("  rigid body  %-20s %.2f\n", integrationMethodName(body.method), double(allocations - before) / steps);
+        }
+
+        // the particle arrays and stage buffers of every method, after a first
+        // step has sized them
+        ParticleSystem::Vec3Array teapot;
+        vector<int> teapotTriangles;
+        if (loadModel("models/tea.obj", teapot, teapotTriangles))
+            for (int m = 0; m < (int)IntegrationMethod::COUNT; m++) {
+                ParticleSystem points;
+                for (int i = 0; i < teapot.size(); i++)
+                    points.add(teapot[i]);
+                points.method = (IntegrationMethod)m;
+                SpringForceModel model;
+                model.network.buildAllPairs(points.x);
+                model.attach(points);
+                points.advanceState(0.0f, 0.001f);
+                const int steps = 1000;
+                size_t before = allocations;
+                for (int s = 1; s <= steps; s++)
+                    points.advanceState(s * 0.001f, 0.001f);
+                printf("  teapot      %-20s %.2f\n", integrationMethodName(points.method), double(allocations - before) / steps);
+            }
+
+        // a frame of the demo with all-pairs springs: an RK4 step and the stairs
+        ThreadPool pool;
+        const char* names[] = { "cube", "sphere", "teapot" };
+        const char* paths[] = { "models/cube.v5.obj", "models/spherev2.obj", "models/tea.obj" };
+        for (int c = 0; c < 3; c++) {
+            ParticleSystem::Vec3Array rest;
+            vector<int> triangles;
+            if (!loadModel(paths[c], rest, triangles))
+                continue;
+            ParticleSystem points;
+            for (int i = 0; i < rest.size(); i++)
+                points.add(rest[i] - vec3(1.0f, 0.0f, 0.0f));
+            points.threadPool = &pool;
+            SpringForceModel model;
+            model.network.buildAllPairs(points.x);
+            model.attach(points);
+            points.advanceState(0.0f, 0.0035f);
+            const int frames = 200;
+            size_t before = allocations, beforeBytes = allocatedBytes;
+            for (int f = 0; f < frames; f++) {
+                points.advanceState(f * 0.0035f, 0.0035f);
+                checkStairCollision(points);
+            }
+            printf("  %-11s %-20s %.2f (%.0f bytes)\n", names[c], "springs, RK4", double(allocations - before) / frames,
+                double(allocatedBytes - beforeBytes) / frames);
+
+            // the same frames through the original closures, without the
+            // stairs, whose collision no longer takes a single body
+            vector<original::Particle> particles(rest.size());
+            vector<vector<float> > restingLengths(rest.size(), vector<float>(rest.size()));
+            for (int i = 0; i < rest.size(); i++) {
+                particles[i].x = rest[i] - vec3(1.0f, 0.0f, 0.0f);
+                for (int j = 0; j < rest.size(); j++)
+                    restingLengths[i][j] = length(rest[i] - rest[j]);
+            }
+            before = allocations;
+            beforeBytes = allocatedBytes;
+            for (int f = 0; f < frames; f++)
+                for (int i = 0; i < particles.size(); i++) {
+                    original::recalculatePointForces(particles, restingLengths, i, 1.0f, 1.0f);
+                    particles[i].advanceState(f * 0.0035f, 0.0035f);
+                }
+            printf("  %-11s %-20s %.2f (%.0f bytes)\n", names[c], "original closures", double(allocations - before) / frames,
+                double(allocatedBytes - beforeBytes) / frames);
+        }
+    }
+
+    /**
+    * Step cost and relative energy drift of every integration method over 2 s
+    * of the undamped all-pairs spring models, released from a 10% stretch
+    * along x at dt = 0.005 without collisions.
+    */
+    void benchIntegrators() {
+        printf("Integrators: us per step and relative energy drift over 2 s\n");
+        const char* names[] = { "cube", "sphere", "teapot" };
+        const char* paths[] = { "models/cube.v5.obj", "models/spherev2.obj", "models/tea.obj" };
+        const float dt = 0.005f;
+        const int steps = int(2.0f / dt);
+        for (int c = 0; c < 3; c++) {
+            ParticleSystem::Vec3Array rest;
+            vector<int> triangles;
+            if (!loadModel(paths[c], rest, triangles))
+                continue;
+            printf("  %s\n", names[c]);
+            for (int m = 0; m < (int)IntegrationMethod::COUNT; m++) {
+                ParticleSystem points;
+                for (int i = 0; i < rest.size(); i++)
+                    points.add(rest[i]);
+                SpringForceModel model;
+                model.network.buildAllPairs(points.x);
+                model.dampFactor = 0.0f;
+                model.attach(points);
+                vector<SpringNetwork::Spring> springs;
+                model.network.list(springs);
+                auto energy = [&]() {
+                    double e = 0.0;
+                    for (int i = 0; i < points.size(); i++)
+                        e += 0.5 * dot(points.P[i], points.P[i]) * points.invM[i] + points.mass(i) * gravity * points.x[i].y;
+                    for (int s = 0; s < springs.size(); s++) {
+                        double stretch = length(points.x[springs[s].i] - points.x[springs[s].j]) - springs[s].rest;
+                        e += 0.5 * 100.0 * stretch * stretch;
+                    }
+                    return e;
+                };
+                for (int i = 0; i < points.size(); i++)
+                    points.x[i].x *= 1.1f;
+                points.method = (IntegrationMethod)m;
+                double before = energy();
+                int step = 0;
+                double us = timeMicroseconds(steps, [&]() {
+                    points.advanceState(step * dt, dt);
+                    step++;
+                });
+                double drift = (energy() - before) / std::fabs(before);
+                printf("    %-20s %9.2f  %+.1e\n", integrationMethodName(points.method), us, drift);
+            }
+        }
+    }
+
+    struct Section {
+        const char* name;
+        void (*run)();
+    };
+    const Section sections[] = {
+        { "allocations", benchAllocations },
+        { "integrators", benchIntegrators },
+        { "springs", benchSprings },
+        { "ffd", benchFfd },
+    };
+}
+
+int main(int argc, char** argv) {
+    int count = sizeof(sections) / sizeof(sections[0]);
+    for (int s = 0; s < count; s++) {
+        bool selected = argc < 2;
+        for (int a = 1; a < argc; a++)
+            selected = selected || strcmp(argv[a], sections[s].name) == 0;
+        if (selected)
+            sections[s].run();
+    }
+    for (int a = 1; a < argc; a++) {
+        bool known = false;
+        for (int s = 0; s < count; s++)
+            known = known || strcmp(argv[a], sections[s].name) == 0;
+        if (!known)
+            printf("Unknown section %s\n", argv[a]);
+    }
+    return 0;
+}
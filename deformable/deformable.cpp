@@ -22,11 +22,20 @@
 #include <common/camera.h>
 #include <common/model.h>
 #include <common/texture.h>
+#include <common/threadpool.h>
 
 // Extras
 #include "Collision.h"
-#include "RigidBody.h"
+#include "ParticleSystem.h"
 #include "Point-Spring-Handling.h"
+#include "PositionBasedDynamics.h"
+#include "ProjectiveDynamics.h"
+#include "ShapeMatching.h"
+#include "CorotationalFem.h"
+#include "ModalReduction.h"
+#include "FreeFormDeformation.h"
+#include "CageEmbedding.h"
+#include "SpringNetwork.h"
 #include "Grab.h"
 
 using namespace std;
@@ -40,22 +49,40 @@ void free();
 struct Light; struct Material;
 void uploadMaterial(const Material& mtl);
 void uploadLight(const Light& light);
-void extractObjVertices(vector<RigidBody> rigids, vector<vec3>& vertices);
-bool loadFileVertices(char* path, vector<vec3>& vertices);
+void extractObjVertices(const ParticleSystem::Vec3Array& previous, const ParticleSystem& points, float alpha, vector<vec3>& vertices);
+void advancePhysics(float t, float dt, float kFactor, float dampFactor);
+bool loadFileVertices(const char* path, vector<vec3>& vertices);
 void userMenu();
 void handleMassKDamp(float& mass, float& k, float& damp, float dt);
+void handleIntegrator();
+bool keyPressedOnce(int key);
 void handleGrab(float dt);
 void handleDistort(float dt);
 void ffdCreateContext();
 void ffdLoop();
-void ffdExtractVertices(vector<RigidBody> rigids, vector<vec3>& vertices);
+void ffdExtractVertices(const ParticleSystem::Vec3Array& previous, const ParticleSystem& points, float alpha, vector<vec3>& vertices);
 void ffdHandleGrab();
-void ffdUpdate();
+bool ffdUpdate();
 void handleNumbers();
 
 #define W_WIDTH 1024
 #define W_HEIGHT 768
 #define TITLE "Deformable (kinda)"
+// physics ticks per second of wall-clock time, each advances the simulation by dt
+#define PHYSICS_RATE 60.0
+// ticks run per rendered frame at most, time beyond them is dropped
+#define MAX_SUBSTEPS 5
+// above this many particles the all-pairs rest lengths are stored as half floats
+#define HALF_PRECISION_PARTICLES 4096
+// cutoff radius of the neighbour springs, in mean mesh edge lengths
+#define CUTOFF_EDGE_LENGTHS 2.5f
+// every particle of a cutoff object is also tied to this many anchors spread over it, which keep its global shape
+#define CUTOFF_ANCHORS 8
+// shape matching splits objects with more particles into clusters of this radius, in mean edge lengths
+#define CLUSTER_PARTICLES 100
+#define CLUSTER_EDGE_LENGTHS 3.0f
+// vibration modes kept by the reduced model, cached in the working directory
+#define MODAL_MODES 16
 // user model choices
 #define CUBE '1'
 #define SPHERE '2'
@@ -66,6 +93,17 @@ void handleNumbers();
 #define GRAB '2'
 #define DISTORT '3'
 #define FFD '4' // Free Form Deformation
+// user solver choices
+#define SPRINGS '1'
+#define XPBD '2' // Extended Position Based Dynamics
+#define PROJECTIVE '3' // Projective Dynamics
+#define SHAPE_MATCHING '4'
+#define FEM '5' // co-rotational Finite Element Method
+#define MODAL '6' // reduced order modal model
+// user spring choices
+#define ALL_PAIRS '1'
+#define MESH_EDGES '2'
+#define NEIGHBOURS '3'
 
 // global variables
 GLFWwindow* window;
@@ -75,12 +113,18 @@ GLuint shaderProgram;
 GLuint projectionMatrixLocation, viewMatrixLocation, modelMatrixLocation;
 GLuint useTexture;
 vector<int> objTriangles;
+// triangles over the particles: those of the model, or the faces of its proxy
+vector<int> physicsTriangles;
 GLuint textureID, textureSampler;
 
 // user choice variables
 char userChoiceMode;
 char userChoiceModel;
 char userChoiceTexture;
+char userChoiceSolver;
+char userChoiceSprings;
+// proxy cells along the longest side of the model, 0 simulates the model's own vertices
+int proxyCells;
 
 // light properties
 GLuint LaLocation, LdLocation, LsLocation, lightPositionLocation, lightPowerLocation;
@@ -92,26 +136,36 @@ Drawable* stairsDraw;
 vector<vec3> stairsVertices, stairsNormals;
 vector<vec2> stairsUVs;
 
+// simulation threads, DEFORMABLE_THREADS of them (default: every hardware thread)
+ThreadPool* threadPool;
+
 // model variables
 Drawable* objDraw;
-vector<RigidBody> objRigids;
-vector<vector<float>> objPointRestingLengths;
+CageEmbedding proxy;
+ParticleSystem::Vec3Array proxyPositions;
+ParticleSystem objParticles;
+XpbdSolver xpbd;
+ProjectiveDynamicsSolver projective;
+ShapeMatchingSolver shapeMatching;
+CorotationalFem objFem;
+ModalReduction modal;
+SpringForceModel objSpringModel;
 vector<vec3> objVertices, objNormals;
 vector<vec2> objUVs;
 vector<vec3> vertexPositions;
 
 // ffd model variables
 float objEdges[3][2];
-void findObjEdges();
+void findObjEdges(const vector<vec3>& vertices);
 vector<vec3> ffdVertexPositions;
 vector<vec3> ffdInitialVertexPositions;
 int vertexGrab;
 Drawable* ffdTeaDraw;
-vector<vec3> ffdTeaVertexPositions;
-vector<vec3> ffdInitialTeaVertexPositions;
 vector<vec3> ffdTeaVertices, ffdTeaNormals;
 vector<vec2> ffdTeaUVs;
-vector<vector<float>> ffdDefaultDistances;
+// lattice cells along x, y and z, 1 1 1 being the box of tea_ffd.obj
+int ffdCells[3];
+FfdLattice ffdLattice;
 
 
 struct Light {
@@ -237,27 +291,69 @@ void createContext() {
 	// create the drawable model
 	objDraw = new Drawable(objVertices, objUVs, objNormals);
 
-	// create a rigid body for every vertex
-	for (int i = 0; i < vertexPositions.size(); i++) {
-		objRigids.push_back(RigidBody());
-		objRigids[i].x = vertexPositions[i];
+	// create a particle for every vertex, or for every node of a coarse proxy
+	// that the model is embedded in
+	ParticleSystem::Vec3Array particlePositions(vertexPositions.begin(), vertexPositions.end());
+	physicsTriangles = objTriangles;
+	if (proxyCells > 0) {
+		proxy.threadPool = threadPool;
+		proxy.build(vertexPositions, objTriangles, proxyCells, "");
+		proxy.setRenderIndices(objTriangles);
+		particlePositions = proxy.nodes();
+		physicsTriangles = proxy.triangles();
+		cout << "Proxy: " << particlePositions.size() << " nodes, " << proxy.tetrahedra().size()
+			<< " tetrahedra for " << vertexPositions.size() << " vertices"
+			<< (proxy.cached ? " from the cache" : "") << endl;
+	}
+	for (int i = 0; i < particlePositions.size(); i++) {
+		objParticles.add(particlePositions[i]);
 		if (userChoiceMode == BOUNCE)
-			objRigids[i].x -= vec3(1.0f, 0.0f, 0.0f);
+			objParticles.x[i] -= vec3(1.0f, 0.0f, 0.0f);
 	}
 
-	// iterate over every distance between vertices and mark down their distance in resting position
-	for (int i = 0; i < objRigids.size(); i++)
-	{
-		objPointRestingLengths.push_back(vector<float>());
-		for (int j = 0; j < objRigids.size(); j++)
-		{
-			objPointRestingLengths[i].push_back(float());
-			if (i == j)
-				continue;
-			objPointRestingLengths[i][j] = length(objRigids[i].x - objRigids[j].x);
+	// the proxy is its own volume mesh
+	if (userChoiceSolver == FEM && proxyCells > 0) {
+		objFem.setElements(objParticles, proxy.tetrahedra());
+		cout << objFem.elements() << " tetrahedra" << endl;
+	}
+	// the volume elements join the surface to interior particles appended after it
+	else if (userChoiceSolver == FEM) {
+		ParticleSystem::Vec3Array interior;
+		vector<CorotationalFem::Tetrahedron> tets;
+		if (CorotationalFem::tetrahedralize(objParticles.x, objTriangles, interior, tets)) {
+			for (int i = 0; i < interior.size(); i++)
+				objParticles.add(interior[i]);
+			objFem.setElements(objParticles, tets);
+			cout << objFem.elements() << " tetrahedra" << endl;
+		}
+		// the menu asked no springs question for the elements, so pick the mesh edges
+		else {
+			cout << "The model cannot be tetrahedralized, using mesh edge springs" << endl;
+			userChoiceSolver = SPRINGS;
+			userChoiceSprings = MESH_EDGES;
 		}
 	}
 
+	// connect the particles with springs at their resting distance; shape
+	// matching builds its goals from the rest positions and the elements
+	// attach their own forces, so neither has springs
+	if (userChoiceSolver != SHAPE_MATCHING && userChoiceSolver != FEM) {
+		if (userChoiceSprings == MESH_EDGES)
+			objSpringModel.network.buildFromMesh(objParticles.x, physicsTriangles);
+		else if (userChoiceSprings == NEIGHBOURS)
+			objSpringModel.network.buildWithinRadius(objParticles.x,
+				CUTOFF_EDGE_LENGTHS * SpringNetwork::meanEdgeLength(objParticles.x, physicsTriangles), CUTOFF_ANCHORS);
+		else
+			objSpringModel.network.buildAllPairs(objParticles.x, objParticles.size() > HALF_PRECISION_PARTICLES);
+		const SpringNetwork& springs = objSpringModel.network;
+		cout << springs.count() << " springs (" << springs.structural << " structural, "
+			<< springs.shear << " shear, " << springs.bending << " bending), "
+			<< springs.memory() / 1024 << " KB" << endl;
+		if (springs.packedRestData())
+			cout << "Spring kernel: " << simdLevelName(objSpringModel.simdLevel()) << endl;
+		objSpringModel.attach(objParticles);
+	}
+
 	// stairs initialization
 	{
 		loadOBJWithTiny("models/stairs.obj", stairsVertices, stairsUVs, stairsNormals);
@@ -292,8 +388,63 @@ void mainLoop() {
 	else if (userChoiceModel == TEAPOT) {
 		dt = 0.022f;
 	}
+	if (userChoiceSolver == XPBD)
+		xpbd.setConstraints(objSpringModel.network);
+	// factor the global matrix once, advanceState refactors it only when mass or K change
+	if (userChoiceSolver == PROJECTIVE) {
+		projective.setConstraints(objSpringModel.network);
+		projective.kFactor = kFactor;
+		projective.prefactor(objParticles, dt);
+	}
+	// the rest shape is the loaded one, large objects are matched in clusters
+	if (userChoiceSolver == SHAPE_MATCHING) {
+		float radius = 0.0f;
+		if (objParticles.size() > CLUSTER_PARTICLES)
+			radius = CLUSTER_EDGE_LENGTHS * SpringNetwork::meanEdgeLength(objParticles.x, physicsTriangles);
+		shapeMatching.setRestShape(objParticles, radius);
+		cout << shapeMatching.clusters() << " shape matching clusters" << endl;
+	}
+	// implicit Euler is selected for the stiff elements; the I key still cycles the integrators
+	if (userChoiceSolver == FEM) {
+		objFem.attach(objParticles);
+		objParticles.method = IntegrationMethod::IMPLICIT_EULER;
+	}
+	// the modes of the rest spring stiffness, solved once per model and then cached
+	if (userChoiceSolver == MODAL) {
+		BlockSparseMatrix dfdx, dfdv;
+		objSpringModel.kFactor = 1.0f;
+		objSpringModel.jacobians(objParticles, objParticles.x, objParticles.v, dfdx, dfdv);
+		if (modal.reduce(objParticles, dfdx, MODAL_MODES, "")) {
+			cout << modal.modes() << " modes" << (modal.cached ? " from the cache" : "") << endl;
+			modal.reset(objParticles);
+		}
+		else {
+			cout << "The modal analysis failed, using springs" << endl;
+			userChoiceSolver = SPRINGS;
+		}
+	}
+	// fixed-step scheduler: wall-clock time is accumulated and spent in whole
+	// ticks, the model is drawn interpolated between the last two ticks
+	const double tick = 1.0 / PHYSICS_RATE;
+	double accumulator = 0.0;
+	double previousTime = glfwGetTime();
+	float simulationTime = 0.0f;
+	ParticleSystem::Vec3Array previousPositions = objParticles.x;
 	do {
-		float time = glfwGetTime();
+		double time = glfwGetTime();
+		accumulator += time - previousTime;
+		previousTime = time;
+		int substeps = 0;
+		while (accumulator >= tick && substeps < MAX_SUBSTEPS) {
+			previousPositions = objParticles.x;
+			advancePhysics(simulationTime, dt, kFactor, dampFactor);
+			simulationTime += dt;
+			accumulator -= tick;
+			substeps++;
+		}
+		// do not try to catch up what the cap left over, so rendering never stalls
+		if (accumulator >= tick)
+			accumulator = fmod(accumulator, tick);
 		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
 		// Camera and Light
@@ -320,13 +471,8 @@ void mainLoop() {
 			glUniform1i(useTexture, 1);
 		}
 
-		for (int i = 0; i < objRigids.size(); i++) {
-			recalculatePointForces(objRigids, objPointRestingLengths, i, 1.0f, 1.0f);
-			objRigids[i].advanceState(time, dt);
-			checkStairCollision(objRigids[i]);
-		}
 		uploadMaterial(goldMaterial);
-		extractObjVertices(objRigids, objVertices);
+		extractObjVertices(previousPositions, objParticles, float(accumulator / tick), objVertices);
 		objDraw->updateModel(objVertices, objUVs, objNormals);
 		objDraw->bind();
 		objDraw->draw();
@@ -340,7 +486,7 @@ void mainLoop() {
 		}
 
 		
-		float deltaTime = glfwGetTime() - time;
+		float deltaTime = float(glfwGetTime() - time);
 
 		if (userChoiceMode == GRAB) {
 			grab->update();
@@ -353,6 +499,7 @@ void mainLoop() {
 		}
 
 		handleMassKDamp(mass, kFactor, dampFactor, deltaTime);
+		handleIntegrator();
 
 		glfwSwapBuffers(window);
 		glfwPollEvents();
@@ -364,12 +511,60 @@ void free() {
 	glfwTerminate();
 }
 
-void extractObjVertices(vector<RigidBody> rigids, vector<vec3>& vertices) {
+void advancePhysics(float t, float dt, float kFactor, float dampFactor) {
+	// damping and K-factor follow the keyboard controls
+	objSpringModel.kFactor = kFactor;
+	objSpringModel.dampFactor = dampFactor;
+	if (userChoiceSolver == XPBD) {
+		xpbd.kFactor = kFactor;
+		xpbd.dampFactor = dampFactor;
+		xpbd.advanceState(objParticles, dt);
+	}
+	else if (userChoiceSolver == PROJECTIVE) {
+		projective.kFactor = kFactor;
+		projective.dampFactor = dampFactor;
+		projective.advanceState(objParticles, dt);
+		checkStairCollision(objParticles);
+	}
+	else if (userChoiceSolver == SHAPE_MATCHING) {
+		// K-factor 0.5..5 maps to pulling 10%..100% of the way to the goals per step
+		shapeMatching.stiffness = kFactor / 5.0f;
+		shapeMatching.dampFactor = dampFactor;
+		shapeMatching.advanceState(objParticles, dt);
+		checkStairCollision(objParticles);
+	}
+	else if (userChoiceSolver == MODAL) {
+		// contacts are handled inside, on the reduced state
+		modal.kFactor = kFactor;
+		modal.dampFactor = dampFactor;
+		modal.advanceState(objParticles, dt);
+	}
+	else if (userChoiceSolver == FEM) {
+		objFem.kFactor = kFactor;
+		objFem.dampFactor = dampFactor;
+		objParticles.advanceState(t, dt);
+		checkStairCollision(objParticles);
+	}
+	else {
+		objParticles.advanceState(t, dt);
+		checkStairCollision(objParticles);
+	}
+}
+
+void extractObjVertices(const ParticleSystem::Vec3Array& previous, const ParticleSystem& points, float alpha, vector<vec3>& vertices) {
+	if (proxyCells > 0) {
+		// the model follows the interpolated proxy
+		proxyPositions.resize(points.size());
+		for (int i = 0; i < points.size(); i++)
+			proxyPositions[i] = mix(previous[i], points.x[i], alpha);
+		proxy.deform(proxyPositions, vertices);
+		return;
+	}
 	for (int i = 0; i < objTriangles.size(); i++)
-		vertices[i] = rigids[objTriangles[i]].x;
+		vertices[i] = mix(previous[objTriangles[i]], points.x[objTriangles[i]], alpha);
 }
 
-bool loadFileVertices(char* path, vector<vec3>& vertices) {
+bool loadFileVertices(const char* path, vector<vec3>& vertices) {
 	FILE* file = fopen(path, "r");
 	objTriangles.clear();
 	if (file == NULL) {
@@ -478,14 +673,14 @@ void handleMassKDamp(float &mass, float& k, float& damp, float dt) {
 		if (mass > 10.0f)
 			mass = 10.0f;
 		if (userChoiceModel == CUBE)
-			for (int i = 0; i < objRigids.size(); i++)
-				objRigids[i].m = mass;
+			for (int i = 0; i < objParticles.size(); i++)
+				objParticles.setMass(i, mass);
 		if (userChoiceModel == SPHERE)
-			for (int i = 0; i < objRigids.size(); i++)
-				objRigids[i].m = mass;
+			for (int i = 0; i < objParticles.size(); i++)
+				objParticles.setMass(i, mass);
 		if (userChoiceModel == CYLINDER)
-			for (int i = 0; i < objRigids.size(); i++)
-				objRigids[i].m = mass;
+			for (int i = 0; i < objParticles.size(); i++)
+				objParticles.setMass(i, mass);
 	}
 	if (glfwGetKey(window, GLFW_KEY_J) == GLFW_PRESS) {
 		pressed = true;
@@ -493,14 +688,14 @@ void handleMassKDamp(float &mass, float& k, float& damp, float dt) {
 		if (mass < 0.5f)
 			mass = 0.5f;
 		if (userChoiceModel == CUBE)
-			for (int i = 0; i < objRigids.size(); i++)
-				objRigids[i].m = mass;
+			for (int i = 0; i < objParticles.size(); i++)
+				objParticles.setMass(i, mass);
 		if (userChoiceModel == SPHERE)
-			for (int i = 0; i < objRigids.size(); i++)
-				objRigids[i].m = mass;
+			for (int i = 0; i < objParticles.size(); i++)
+				objParticles.setMass(i, mass);
 		if (userChoiceModel == CYLINDER)
-			for (int i = 0; i < objRigids.size(); i++)
-				objRigids[i].m = mass;
+			for (int i = 0; i < objParticles.size(); i++)
+				objParticles.setMass(i, mass);
 	}
 
 	if (glfwGetKey(window, GLFW_KEY_Y) == GLFW_PRESS) {
@@ -534,19 +729,42 @@ void handleMassKDamp(float &mass, float& k, float& damp, float dt) {
 	}
 }
 
+bool keyPressedOnce(int key) {
+	// true only on the frame the key goes down
+	static map<int, bool> wasPressed;
+	bool pressed = glfwGetKey(window, key) == GLFW_PRESS;
+	bool once = pressed && !wasPressed[key];
+	wasPressed[key] = pressed;
+	return once;
+}
+
+void handleIntegrator() {
+	if (keyPressedOnce(GLFW_KEY_I)) {
+		objParticles.method = nextIntegrationMethod(objParticles.method);
+		cout << "\nIntegrator: " << integrationMethodName(objParticles.method);
+	}
+	if (keyPressedOnce(GLFW_KEY_O) && objParticles.method == IntegrationMethod::DORMAND_PRINCE) {
+		const StepStatistics& stats = objParticles.statistics;
+		cout << "\nSteps: " << stats.acceptedSteps << " (" << stats.rejectedSteps << " rejected)"
+			<< " step min/avg/max: " << stats.minStep << "/" << stats.averageStep() << "/" << stats.maxStep
+			<< " force evaluations per simulated second: " << stats.work();
+		objParticles.statistics.reset();
+	}
+}
+
 void handleGrab(float dt) {
 	if (glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_LEFT) == GLFW_PRESS) {
 		if (userChoiceModel != CUBE)
 			dt /= 10;
 		float x = - grab->horizontalOffset * 1/dt * 1 / 1000;
 		float y = grab->verticalOffset * 1/dt * 1 / 1000;
-		for (int i = 0; i < objRigids.size(); i++) {
-			objRigids[i].x.x += x;
-			objRigids[i].x.y += y;
-			objRigids[i].v.x = x;
-			objRigids[i].v.y = y;
-			objRigids[i].P.x = objRigids[i].v.x * objRigids[i].m * 1 / dt * 1 / 10;
-			objRigids[i].P.y = objRigids[i].v.y * objRigids[i].m * 1 / dt * 1/10;
+		for (int i = 0; i < objParticles.size(); i++) {
+			objParticles.x[i].x += x;
+			objParticles.x[i].y += y;
+			objParticles.v[i].x = x;
+			objParticles.v[i].y = y;
+			objParticles.P[i].x = objParticles.v[i].x * objParticles.mass(i) * 1 / dt * 1 / 10;
+			objParticles.P[i].y = objParticles.v[i].y * objParticles.mass(i) * 1 / dt * 1/10;
 		}
 	}
 }
@@ -559,13 +777,13 @@ void handleDistort(float dt) {
 		float y = grab->verticalOffset * 1 / dt * 1 / 1000;
 		cout << x << "\n";
 		for (int j = 0; j < 3; j++) {
-			int i = objTriangles[j];
-			objRigids[i].x.x += x;
-			objRigids[i].x.y += y;
-			objRigids[i].v.x = x;
-			objRigids[i].v.y = y;
-			objRigids[i].P.x = objRigids[i].v.x * objRigids[i].m * 1 / dt * 1 / 10;
-			objRigids[i].P.y = objRigids[i].v.y * objRigids[i].m * 1 / dt * 1 / 10;
+			int i = physicsTriangles[j];
+			objParticles.x[i].x += x;
+			objParticles.x[i].y += y;
+			objParticles.v[i].x = x;
+			objParticles.v[i].y = y;
+			objParticles.P[i].x = objParticles.v[i].x * objParticles.mass(i) * 1 / dt * 1 / 10;
+			objParticles.P[i].y = objParticles.v[i].y * objParticles.mass(i) * 1 / dt * 1 / 10;
 		}
 	}
 }
@@ -596,47 +814,35 @@ void ffdCreateContext() {
 		useTexture = glGetUniformLocation(shaderProgram, "useTexture");
 	}
 
-	loadFileVertices("models/tea_ffd.obj", vertexPositions);
-	loadFileVertices("models/tea_ffd.obj", ffdInitialVertexPositions);
+	// the teapot is parsed once, for its positions and its triangles
+	vector<vec3> teaVertexPositions;
+	loadFileVertices("models/tea.obj", teaVertexPositions);
 
-	// cube model loading
-	//loadOBJWithTiny("models/tea_ffd.obj", vertexPositions);
+	// Bernstein lattice on the bounds of the teapot, its control points are the particles
+	findObjEdges(teaVertexPositions);
+	ffdLattice.setLattice(vec3(objEdges[0][0], objEdges[1][0], objEdges[2][0]),
+		vec3(objEdges[0][1], objEdges[1][1], objEdges[2][1]), ffdCells[0], ffdCells[1], ffdCells[2]);
+	vertexPositions = ffdLattice.restControlPoints();
+	ffdInitialVertexPositions = vertexPositions;
 
 	// create the drawable model
 	objDraw = new Drawable(vertexPositions);
 
-	// create a rigid body for every vertex
+	// create a particle for every vertex
 	for (int i = 0; i < vertexPositions.size(); i++) {
-		objRigids.push_back(RigidBody());
-		objRigids[i].x = vertexPositions[i];
-		objRigids[i].x -= vec3(0.00001f, 0.00001f, 0.00001f);
-	}
-
-	// iterate over every distance between vertices and mark down their distance in resting position
-	for (int i = 0; i < objRigids.size(); i++)
-	{
-		objPointRestingLengths.push_back(vector<float>());
-		for (int j = 0; j < objRigids.size(); j++)
-		{
-			objPointRestingLengths[i].push_back(float());
-			if (i == j)
-				continue;
-			objPointRestingLengths[i][j] = length(objRigids[i].x - objRigids[j].x);
-		}
+		objParticles.add(vertexPositions[i]);
+		objParticles.x[i] -= vec3(0.00001f, 0.00001f, 0.00001f);
 	}
 
-	loadFileVertices("models/tea.obj", ffdInitialTeaVertexPositions);
-	loadFileVertices("models/tea.obj", ffdTeaVertexPositions);
 	// teapot model loading
 	loadOBJWithTiny("models/tea.obj", ffdTeaVertices, ffdTeaUVs, ffdTeaNormals);
 	ffdTeaDraw = new Drawable(ffdTeaVertices, ffdTeaUVs, ffdTeaNormals);
 
-	for (int i = 0; i < ffdTeaVertexPositions.size(); i++) {
-		ffdDefaultDistances.push_back(vector<float>());
-		for (int j = 0; j < vertexPositions.size(); j++) {
-			ffdDefaultDistances[i].push_back(length(ffdTeaVertexPositions[i] - vertexPositions[j]));
-		}
-	}
+	// the lattice weights of the teapot vertices, once; the lattice writes the
+	// triangle corners of the drawable directly
+	ffdLattice.threadPool = threadPool;
+	ffdLattice.embed(teaVertexPositions);
+	ffdLattice.setRenderIndices(objTriangles);
 	vertexGrab = 0;
 	glUseProgram(shaderProgram);
 }
@@ -645,9 +851,34 @@ void ffdLoop() {
 	camera->position = vec3(1.5, -1.0, 7.0);
 	camera->update();
 	float dt = 0.00035f;
+	objParticles.forcing = [](float t, const ParticleSystem::Vec3Array& x, const ParticleSystem::Vec3Array& v, ParticleSystem::Vec3Array& f) {
+		ffdCalculatePointForces(objParticles, ffdInitialVertexPositions, x, v, f, 15.0f, 3.0f);
+	};
+	objParticles.forceJacobian = [](float t, const ParticleSystem::Vec3Array& x, const ParticleSystem::Vec3Array& v, BlockSparseMatrix& dfdx, BlockSparseMatrix& dfdv) {
+		ffdCalculatePointForceJacobians(objParticles, dfdx, dfdv, 15.0f, 3.0f);
+	};
+	// the same fixed-step scheduler as mainLoop, the lattice is drawn and
+	// applied interpolated between the last two ticks
+	const double tick = 1.0 / PHYSICS_RATE;
+	double accumulator = 0.0;
+	double previousTime = glfwGetTime();
+	float simulationTime = 0.0f;
+	ParticleSystem::Vec3Array previousPositions = objParticles.x;
 	do
 	{
-		float time = glfwGetTime();
+		double time = glfwGetTime();
+		accumulator += time - previousTime;
+		previousTime = time;
+		int substeps = 0;
+		while (accumulator >= tick && substeps < MAX_SUBSTEPS) {
+			previousPositions = objParticles.x;
+			objParticles.advanceState(simulationTime, dt);
+			simulationTime += dt;
+			accumulator -= tick;
+			substeps++;
+		}
+		if (accumulator >= tick)
+			accumulator = fmod(accumulator, tick);
 		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
 		if (glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_LEFT) != GLFW_PRESS)
@@ -667,23 +898,17 @@ void ffdLoop() {
 			glUniformMatrix4fv(modelMatrixLocation, 1, GL_FALSE, &mat4()[0][0]);
 		}
 
-		for (int i = 0; i < objRigids.size(); i++) {
-			ffdRecalculatePointForces(objRigids, ffdInitialVertexPositions, i, 15.0f, 3.0f);
-			objRigids[i].advanceState(time, dt);
-		}
 		uploadMaterial(goldMaterial);
-		ffdExtractVertices(objRigids, vertexPositions);
+		ffdExtractVertices(previousPositions, objParticles, float(accumulator / tick), vertexPositions);
 		objDraw->updateModel(vertexPositions);
 		objDraw->bind();
 		objDraw->draw(GL_POINTS);
 
-		ffdUpdate();
+		// the teapot buffer is only uploaded when a control point moved
+		if (ffdUpdate())
+			ffdTeaDraw->updateModel(ffdTeaVertices, ffdTeaUVs, ffdTeaNormals);
 
 		uploadMaterial(stairMaterial);
-		//extractObjVertices(objRigids, objVertices);
-		for (int i = 0; i < objTriangles.size(); i++)
-			ffdTeaVertices[i] = ffdTeaVertexPositions[objTriangles[i]];
-		ffdTeaDraw->updateModel(ffdTeaVertices, ffdTeaUVs, ffdTeaNormals);
 		glUniform1i(useTexture, 0);
 		ffdTeaDraw->bind();
 		ffdTeaDraw->draw();
@@ -697,27 +922,26 @@ void ffdLoop() {
 	} while (glfwGetKey(window, GLFW_KEY_ESCAPE) != GLFW_PRESS && glfwWindowShouldClose(window) == 0);
 }
 
-void findObjEdges() {
-	loadFileVertices("models/tea.obj", vertexPositions);
+void findObjEdges(const vector<vec3>& vertices) {
 	for (int i = 0; i < 3; i++)
 		for (int j = 0; j < 2; j++)
-			objEdges[i][j] = vertexPositions[0][i];
+			objEdges[i][j] = vertices[0][i];
 
-	for (int indx = 1; indx < vertexPositions.size(); indx++)
+	for (int indx = 1; indx < vertices.size(); indx++)
 	{
 		for (int i = 0; i < 3; i++)
 		{
-			if (vertexPositions[indx][i] < objEdges[i][0])
-				objEdges[i][0] = vertexPositions[indx][i];
-			else if (vertexPositions[indx][i] > objEdges[i][1])
-				objEdges[i][1] = vertexPositions[indx][i];
+			if (vertices[indx][i] < objEdges[i][0])
+				objEdges[i][0] = vertices[indx][i];
+			else if (vertices[indx][i] > objEdges[i][1])
+				objEdges[i][1] = vertices[indx][i];
 		}
 	}
 }
 
-void ffdExtractVertices(vector<RigidBody> rigids, vector<vec3>& vertices) {
+void ffdExtractVertices(const ParticleSystem::Vec3Array& previous, const ParticleSystem& points, float alpha, vector<vec3>& vertices) {
 	for (int i = 0; i < vertices.size(); i++)
-		vertices[i] = rigids[i].x;
+		vertices[i] = mix(previous[i], points.x[i], alpha);
 }
 
 void ffdHandleGrab() {
@@ -725,24 +949,16 @@ void ffdHandleGrab() {
 		float dt = 0.0035f;
 		float x = -grab->horizontalOffset * dt * 1000;
 		float y = grab->verticalOffset * dt * 1000;
-		objRigids[vertexGrab].x.x += x;
-		objRigids[vertexGrab].x.y += y;
+		// the number keys pick a corner of the lattice, the bits of vertexGrab being x, y and z
+		int control = ffdLattice.index((vertexGrab & 1) * ffdLattice.cells(0),
+			(vertexGrab >> 1 & 1) * ffdLattice.cells(1), (vertexGrab >> 2 & 1) * ffdLattice.cells(2));
+		objParticles.x[control].x += x;
+		objParticles.x[control].y += y;
 	}
 }
 
-void ffdUpdate() {
-	for (int i = 0; i < ffdTeaVertexPositions.size(); i++)
-	{
-		ffdTeaVertexPositions[i] = ffdInitialTeaVertexPositions[i];
-		for (int j = 0; j < vertexPositions.size(); j++)
-		{
-			vec3 dist = vertexPositions[j] - ffdInitialVertexPositions[j];
-			vec3 direction = normalize(dist);
-			float len = length(dist);
-			vec3 dx = dist * (1 / ffdDefaultDistances[i][j]) / 5.0f;
-			ffdTeaVertexPositions[i] += dx;
-		}
-	}
+bool ffdUpdate() {
+	return ffdLattice.update(vertexPositions, ffdTeaVertices);
 }
 
 void handleNumbers() {
@@ -780,8 +996,27 @@ void userMenu() {
 	cout << "4. Free Form Deformation" << endl;
 	cout << "5. Plain fall" << endl;
 	cin >> userChoiceMode;
-	if (userChoiceMode == FFD)
+	if (userChoiceMode == FFD) {
+		cout << "Lattice cells along x, y and z (1 1 1 for the corners only):" << endl;
+		cin >> ffdCells[0] >> ffdCells[1] >> ffdCells[2];
 		return;
+	}
+	cout << "Choose solver:" << endl;
+	cout << "1. Mass-spring" << endl;
+	cout << "2. XPBD" << endl;
+	cout << "3. Projective Dynamics" << endl;
+	cout << "4. Shape Matching" << endl;
+	cout << "5. Co-rotational FEM (cube, sphere, cylinder)" << endl;
+	cout << "6. Modal reduction of the springs" << endl;
+	cin >> userChoiceSolver;
+	// shape matching and the finite elements have no springs
+	if (userChoiceSolver != SHAPE_MATCHING && userChoiceSolver != FEM) {
+		cout << "Choose springs:" << endl;
+		cout << "1. Every pair of vertices" << endl;
+		cout << "2. Mesh edges (structural, shear and bending)" << endl;
+		cout << "3. Neighbouring vertices within a cutoff radius" << endl;
+		cin >> userChoiceSprings;
+	}
 	if (userChoiceMode == BOUNCE)
 		userChoiceModel = CUBE;
 	else
@@ -793,6 +1028,8 @@ void userMenu() {
 		cout << "4. Teapot" << endl;
 		cin >> userChoiceModel;
 	}
+	cout << "Simulate on a coarse proxy, cells along the longest side (0 for none):" << endl;
+	cin >> proxyCells;
 
 	if (userChoiceModel == CYLINDER || userChoiceModel == TEAPOT)
 		return;
@@ -814,6 +1051,9 @@ int main(void) {
 	try {
 		userMenu();
 		initialize();
+		const char* threads = getenv("DEFORMABLE_THREADS");
+		threadPool = new ThreadPool(threads ? atoi(threads) : 0);
+		objParticles.threadPool = threadPool;
 		if (userChoiceMode == FFD)
 		{
 			ffdCreateContext();